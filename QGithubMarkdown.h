@@ -0,0 +1,340 @@
+#pragma once
+
+#include "QMarkdown.h"
+#include "QMarkdownCharacters.h"
+
+#include <QTextCursor>
+#include <QTextList>
+#include <QDebug>
+
+/// Github flavoured markdown. Only QMarkdown.cpp and the benchmarks should need to include this.
+class QGithubMarkdown : public QAbstractMarkdown
+{
+	friend class QMarkdownBench;
+public:
+	void read(const QByteArray &markdown, QTextDocument *target) override;
+	QByteArray write(QTextDocument *source) override;
+	bool write(QTextDocument *source, QIODevice *device) override;
+	bool renderHtml(const QByteArray &markdown, QIODevice *device) override;
+
+	void update(const QByteArray &previous, const QByteArray &markdown, QTextDocument *target) override;
+
+	QSharedPointer<const QMarkdownModel> parse(const QByteArray &markdown, const QAtomicInt *cancelled = 0) const override;
+	void apply(const QSharedPointer<const QMarkdownModel> &model, QTextDocument *target) override;
+	QVector<int> blockSizes(const QSharedPointer<const QMarkdownModel> &model) const override;
+	void applyBlocks(const QSharedPointer<const QMarkdownModel> &model, QTextDocument *target, const int first, const int count) override;
+	bool save(const QSharedPointer<const QMarkdownModel> &model, QIODevice *device) const override;
+	QSharedPointer<const QMarkdownModel> load(const QByteArray &markdown, const QByteArray &data) const override;
+
+	void begin(QTextDocument *target) override;
+	void feed(const QByteArray &chunk) override;
+	void finish() override;
+
+	struct Token
+	{
+		enum Type : quint8
+		{
+			Text,
+			Indent,
+			NewLine,
+
+			HeadingStart,
+			QuoteStart,
+			CodeDelimiter,
+			InlineCodeDelimiter,
+			Bold,
+			Italic,
+
+			ImageStart,
+			LinkStart,
+			LinkMiddle,
+			LinkEnd,
+
+			UnorderedListStart,
+			OrderedListStart,
+
+			HtmlTagOpen,
+			HtmlTagClose,
+
+			Invalid,
+
+			EOD // EndOfDocument
+		};
+		enum Flags : quint8
+		{
+			NoFlags = 0x0,
+			Escaped = 0x1 // the span starts with the escaping backslash
+		};
+
+		Type type;
+		quint8 flags;
+		quint16 payload; // heading level, list item number or indent width
+		int offset; // in bytes into the UTF-8 input
+		int length;
+
+		Token() : type(Invalid), flags(NoFlags), payload(0), offset(0), length(0) {}
+		Token(const Type type, const int offset, const int length, const quint16 payload = 0)
+			: type(type), flags(NoFlags), payload(payload), offset(offset), length(length) {}
+	};
+	struct Paragraph
+	{
+		enum Type
+		{
+			// numbers have to match QGithubMarkdown::sizeMap
+			Heading1 = 1,
+			Heading2 = 2,
+			Heading3 = 3,
+			Heading4 = 4,
+			Heading5 = 5,
+			Heading6 = 6,
+
+			Normal,
+			Quote,
+			Code,
+
+			UnorderedList,
+			OrderedList,
+
+			FirstHeading = Heading1,
+			LastHeading = Heading6
+		} type = Normal;
+		int firstToken = 0; // index into Session::tokens
+		int tokenCount = 0;
+		int indent = 0; // width of the leading whitespace of the first line
+		int offset = -1; // where in the input the paragraph starts
+	};
+	/// A paragraph, or consecutive items of the same list
+	struct Block
+	{
+		int firstParagraph; // index into Session::paragraphs
+		int paragraphCount;
+		int indent; // nesting level of the list, -1 for a paragraph
+		int ordered; // a bool, but as an int the struct has no padding that save() would write out uninitialized
+		int list; // blocks with the same id are items of the same list, which continues after nested lists, -1 for a paragraph
+	};
+	/// Everything that is parsed from a piece of markdown. Nodes refer to each other by index and the stages fill
+	/// flat vectors, so a parse allocates a handful of times and everything is released at once.
+	struct Session
+	{
+		QVector<Token> tokens;
+		QVector<Paragraph> paragraphs;
+		QVector<Block> blocks;
+		int listCount = 0; // lists are numbered from 0 in each session
+
+		/// Appends the nodes of other, adjusting its indices
+		void append(const Session &other);
+	};
+
+private:
+	/// Starts the data written by save(), followed by the tokens, paragraphs and blocks of the session as they are in
+	/// memory. All sizes are multiples of four so the arrays can be used straight from a mapped file.
+	struct SavedHeader
+	{
+		char magic[4]; // QMDG
+		quint32 version;
+		quint32 byteOrder; // savedByteOrder as written by the machine that saved it
+		quint32 sizes; // of Token, Paragraph and Block, a byte each
+		qint32 markdownSize;
+		quint32 markdownHash;
+		qint32 tokenCount;
+		qint32 paragraphCount;
+		qint32 blockCount;
+		qint32 listCount;
+	};
+	static const quint32 savedVersion = 2;
+	static const quint32 savedByteOrder = 0x01020304;
+	static quint32 savedSizes();
+
+	/// Parses the markdown in a single pass. What a line starts is decided as soon as its first tokens are seen, lists
+	/// are kept on a stack of open lists, and paragraphs and blocks are added to the session as soon as they end.
+	/// Only the tokens that make up the content of paragraphs are kept. Characters are classified with the table of
+	/// Traits. Stops early and returns an empty session if cancelled gets set.
+	template <typename Traits = QMarkdownCharacters>
+	Session parseMarkdown(const QByteArray &data, const QAtomicInt *cancelled = 0) const;
+	/// Inserts count blocks starting at first at the cursor, or all of them if count is -1. offset is the position of
+	/// input in the entire markdown.
+	void build(const Session &session, const int offset, const int first = 0, const int count = -1);
+	/// Parses the markdown and inserts it at the cursor, offset is the position of markdown in the entire input
+	void insert(const QByteArray &markdown, const int offset);
+
+	/// Runs all parsing stages, on all cores if the markdown is large enough to make that worth it
+	Session parseBlocks(const QByteArray &markdown, const QAtomicInt *cancelled = 0) const;
+	/// Runs all parsing stages on the part of the markdown between start and end, which needs to be split points
+	Session parseRange(const QByteArray &markdown, const int start, const int end, const QAtomicInt *cancelled = 0) const;
+	/// Below this size the markdown is parsed on the calling thread only
+	static const int parallelThreshold = 256 * 1024;
+	/// How much parseMarkdown() parses between looking at whether it has been cancelled, in bytes
+	static const int cancelCheckInterval = 64 * 1024;
+	/// The smallest part that is handed to a thread of its own
+	static const int minimumPartSize = 32 * 1024;
+
+	/// Finds the positions at which the input can be split into parts that can be parsed independently of
+	/// each other, which is after an empty line outside of fenced code blocks unless a list continues after it
+	struct SplitFinder
+	{
+		int scanned = 0; // start of the first line that hasn't been looked at
+		bool inFence = false; // whether scanned is within a fenced code block
+		bool afterEmptyLine = false; // whether the line before scanned was empty, or only whitespace, and outside of a fenced code block
+
+		/// Looks at the complete lines from scanned on and calls found for each split position. Characters are
+		/// classified with the table of Traits, like parseMarkdown() does.
+		template<typename Traits = QMarkdownCharacters, typename Func>
+		void scan(const QByteArray &input, Func found)
+		{
+			typedef QMarkdownCharacterTable<Traits> Table;
+			const char *data = input.constData();
+			const int size = input.size();
+			auto isDigit = [](const char c) { return Table::is(c, DigitCharacter); };
+			while (scanned < size)
+			{
+				int end = scanned;
+				while (end < size && data[end] != '\n' && data[end] != '\r')
+				{
+					++end;
+				}
+				// incomplete line, or a \r that might be followed by a \n
+				if (end >= size || (data[end] == '\r' && end + 1 >= size))
+				{
+					break;
+				}
+				const int next = (data[end] == '\r' && data[end + 1] == '\n') ? end + 2 : end + 1;
+
+				int first = scanned;
+				while (first < end && Table::is(data[first], SpaceCharacter))
+				{
+					++first;
+				}
+				const bool isListItem = first < end && (Table::is(data[first], BulletCharacter)
+						|| (first + 1 < end && isDigit(data[first]) && data[first + 1] == '.')
+						|| (first + 2 < end && isDigit(data[first]) && isDigit(data[first + 1]) && data[first + 2] == '.'));
+				// more empty lines might be followed by a list item that continues a list
+				if (!inFence && afterEmptyLine && first < end && !isListItem)
+				{
+					found(scanned);
+				}
+				if (end - scanned >= 3 && Table::is(data[scanned], CodeCharacter) && data[scanned + 1] == data[scanned]
+						&& data[scanned + 2] == data[scanned])
+				{
+					inFence = !inFence;
+				}
+				// like the parser, which ends paragraphs there, a line with only whitespace counts as empty
+				afterEmptyLine = !inFence && first == end;
+				scanned = next;
+			}
+		}
+	};
+	/// All positions at which the input can be split, including its start and end
+	static QVector<int> splitPoints(const QByteArray &input);
+
+	/// A link or an image, as the indices of its [ or ![, its ]( and its ) in the tokens of a paragraph
+	struct Link
+	{
+		int start;
+		int middle;
+		int end;
+	};
+	/// Pairs up the tokens of the links and images in the tokens of a paragraph, in a single pass
+	static QVector<Link> findLinks(const Token *tokens, const int count);
+	/// Walks over the tokens of a paragraph that isn't code, with emphasis, inline code, links and images resolved.
+	/// Both build() and renderHtml() are driven by it. All positions are in the input, and style is a combination
+	/// of Style flags:
+	/// onText(offset, length, style) for text to insert as it is,
+	/// onSpace(style) for a line break, which is rendered as a space,
+	/// onLink(urlOffset, urlLength, style) before the text of a link, which then comes with LinkStyle,
+	/// onImage(urlOffset, urlLength, altOffset, altLength, style) for an image.
+	template <typename OnText, typename OnSpace, typename OnLink, typename OnImage>
+	static void walkInline(const Token *tokens, const int count, OnText onText, OnSpace onSpace, OnLink onLink,
+						   OnImage onImage);
+
+	/// The source text of a token, as it was written
+	QString sourceText(const Token &token) const
+	{
+		return decode(token.offset, token.length);
+	}
+	/// Converts a part of the input to a string, tabs are expanded here instead of in a pass over the entire input
+	QString decode(const int offset, const int length) const
+	{
+		QString out = QString::fromUtf8(input.constData() + offset, length);
+		if (out.contains('\t'))
+		{
+			out.replace('\t', QLatin1String("    "));
+		}
+		return out;
+	}
+
+	enum CharStyle
+	{
+		PlainStyle = 0x0,
+		BoldStyle = 0x1,
+		ItalicStyle = 0x2,
+		MonospaceStyle = 0x4,
+		LinkStyle = 0x8 // formatted with QGithubMarkdown::charFormat, but then made an anchor
+	};
+	/// The character format for text with the given style in a paragraph of the given type, the same instance is
+	/// returned every time so that the document can tell right away that it already knows the format
+	const QTextCharFormat &charFormat(const int paragraphType, const int style)
+	{
+		const int key = (paragraphType << 3) | style;
+		QHash<int, QTextCharFormat>::iterator it = charFormats.find(key);
+		if (it == charFormats.end())
+		{
+			QTextCharFormat format;
+			if (Paragraph::FirstHeading <= paragraphType && paragraphType <= Paragraph::LastHeading)
+			{
+				format.setFontPointSize(sizeMap[paragraphType]);
+			}
+			if (paragraphType == Paragraph::Code || style & MonospaceStyle)
+			{
+				format.setFontFamily("Monospace");
+			}
+			if (style & BoldStyle)
+			{
+				format.setFontWeight(QFont::Bold);
+			}
+			if (style & ItalicStyle)
+			{
+				format.setFontItalic(true);
+			}
+			it = charFormats.insert(key, format);
+		}
+		return it.value();
+	}
+	/// Restores the undo/redo state of the document after begin() turned it off
+	void end();
+
+	QByteArray input;
+	bool firstBlock;
+	QHash<int, QTextCharFormat> charFormats;
+	bool undoRedoEnabled; // of the document, before begin() turned it off
+
+	// state of reading using begin(), feed() and finish()
+	QByteArray pending; // input that has been fed but not inserted yet
+	int consumed; // size of the input that has been inserted
+	SplitFinder splitFinder;
+	static const QMap<int, int> sizeMap; // font point size of each heading level
+	QTextCursor cursor;
+	QTextDocument *doc;
+};
+Q_DECLARE_TYPEINFO(QGithubMarkdown::Token, Q_PRIMITIVE_TYPE);
+Q_DECLARE_TYPEINFO(QGithubMarkdown::Paragraph, Q_PRIMITIVE_TYPE);
+Q_DECLARE_TYPEINFO(QGithubMarkdown::Block, Q_PRIMITIVE_TYPE);
+
+/// The paragraphs and lists of a document, as parsed by QGithubMarkdown::parse
+class QGithubMarkdownModel : public QMarkdownModel
+{
+public:
+	explicit QGithubMarkdownModel(const QByteArray &markdown) : QMarkdownModel(markdown) {}
+	QGithubMarkdown::Session session;
+
+	qint64 memoryUsage() const override
+	{
+		return QMarkdownModel::memoryUsage() + session.tokens.capacity() * sizeof(QGithubMarkdown::Token)
+				+ session.paragraphs.capacity() * sizeof(QGithubMarkdown::Paragraph)
+				+ session.blocks.capacity() * sizeof(QGithubMarkdown::Block);
+	}
+};
+
+QDebug operator<<(QDebug dbg, QGithubMarkdown::Token::Type type);
+QDebug operator<<(QDebug dbg, QGithubMarkdown::Token token);
+QDebug operator<<(QDebug dbg, QGithubMarkdown::Paragraph::Type type);
+QDebug operator<<(QDebug dbg, QGithubMarkdown::Paragraph paragraph);
@@ -1,938 +1,1720 @@
 #include "QMarkdown.h"
+#include "QGithubMarkdown.h"
 
-#include <QRegularExpressionMatch>
-#include <QTextCursor>
-#include <QTextList>
-#include <QDebug>
+#include "QMarkdownScanner.h"
+#include "QMarkdownStatistics.h"
 
-// code borrowed from qiterator.h
-class QStringIterator
+#include <QBuffer>
+#include <QMutex>
+#include <QVarLengthArray>
+#include <QThread>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+const QMap<int, int> QGithubMarkdown::sizeMap = {{1, 26}, {2, 24}, {3, 20}, {4, 16}, {5, 14}, {6, 13}};
+const int QGithubMarkdown::parallelThreshold;
+const int QGithubMarkdown::minimumPartSize;
+
+/// Remembers where in the input the paragraph of a block starts, used by QGithubMarkdown::update
+class QGithubMarkdownBlockData : public QTextBlockUserData
 {
-	typedef typename QString::const_iterator const_iterator;
-	QString c;
-	const_iterator i;
 public:
-	inline QStringIterator(const QString &container)
-		: c(container), i(c.constBegin()) {} \
-	inline QStringIterator &operator=(const QString &container)
-	{ c = container; i = c.constBegin(); return *this; }
-	inline void toFront() { i = c.constBegin(); }
-	inline void toBack() { i = c.constEnd(); }
-	inline bool hasNext() const { return i != c.constEnd(); }
-	inline const QChar next() { return *i++; }
-	inline const QChar peekNext() const { return *i; }
-	inline bool hasPrevious() const { return i != c.constBegin(); }
-	inline const QChar previous() { return *--i; }
-	inline const QChar peekPrevious() const { const_iterator p = i; return *--p; }
-	inline bool findNext(const QChar &t)
-	{ while (i != c.constEnd()) if (*i++ == t) return true; return false; }
-	inline bool findPrevious(const QChar &t)
-	{ while (i != c.constBegin()) if (*(--i) == t) return true;
-		return false;  }
+	explicit QGithubMarkdownBlockData(const int offset) : offset(offset) {}
+	int offset;
 };
 
-class QGithubMarkdown : public QAbstractMarkdown
+/// Collects output and writes it to a device whenever enough of it has been collected. Buffer is QString for text,
+/// which is written as UTF-8, or QByteArray for UTF-8 that is written as it is. If trimmed whitespace at the start and
+/// the end of the entire output is left out, like QString::trimmed() does.
+template <typename Buffer>
+class QGithubMarkdownOutput
 {
 public:
-	QGithubMarkdown()
+	explicit QGithubMarkdownOutput(QIODevice *device, const bool trimmed = false) : m_device(device), m_trimmed(trimmed)
 	{
-		if (sizeMap.isEmpty())
+		m_buffer.reserve(bufferSize + 1024);
+	}
+
+	template<typename T>
+	QGithubMarkdownOutput &operator+=(const T &text)
+	{
+		m_buffer += text;
+		if (m_buffer.size() >= bufferSize)
 		{
-			sizeMap[1] = 26;
-			sizeMap[2] = 24;
-			sizeMap[3] = 20;
-			sizeMap[4] = 16;
-			sizeMap[5] = 14;
-			sizeMap[6] = 13;
+			flush(false);
 		}
+		return *this;
 	}
-
-	void read(const QByteArray &markdown, QTextDocument *target) override;
-	QByteArray write(QTextDocument *source) override;
-
-	struct Token
+	/// Appends length bytes of data with the characters that have a meaning in HTML escaped, and tabs expanded
+	void appendEscaped(const char *data, const int length)
 	{
-		enum Type
+		int start = 0;
+		for (int i = 0; i < length; ++i)
 		{
-			Character,
-			NewLine,
-
-			HeadingStart,
-			QuoteStart,
-			CodeDelimiter,
-			InlineCodeDelimiter,
-			Bold,
-			Italic,
-
-			ImageStart,
-			LinkStart,
-			LinkMiddle,
-			LinkEnd,
-
-			UnorderedListStart,
-			OrderedListStart,
+			const char *replacement;
+			switch (data[i])
+			{
+			case '<': replacement = "&lt;"; break;
+			case '>': replacement = "&gt;"; break;
+			case '&': replacement = "&amp;"; break;
+			case '"': replacement = "&quot;"; break;
+			case '\t': replacement = "    "; break;
+			default: continue;
+			}
+			m_buffer.append(data + start, i - start);
+			m_buffer += replacement;
+			start = i + 1;
+		}
+		m_buffer.append(data + start, length - start);
+		if (m_buffer.size() >= bufferSize)
+		{
+			flush(false);
+		}
+	}
+	/// Writes what is left, returns false if writing to the device failed at any point
+	bool finish()
+	{
+		flush(true);
+		return !m_failed;
+	}
 
-			HtmlTagOpen,
-			HtmlTagClose,
+private:
+	void flush(const bool last)
+	{
+		int start = 0;
+		int end = m_buffer.size();
+		if (m_trimmed)
+		{
+			if (!m_started)
+			{
+				while (start < end && isSpace(m_buffer.at(start)))
+				{
+					++start;
+				}
+			}
+			// trailing whitespace is held back until it is known whether anything follows it
+			while (end > start && isSpace(m_buffer.at(end - 1)))
+			{
+				--end;
+			}
+		}
+		if (end > start)
+		{
+			if (m_device->write(utf8(start, end - start)) == -1)
+			{
+				m_failed = true;
+			}
+			m_started = true;
+		}
+		m_buffer.remove(0, last ? m_buffer.size() : qMax(start, end));
+	}
+	static bool isSpace(const QChar c) { return c.isSpace(); }
+	static bool isSpace(const char c) { return QChar::fromLatin1(c).isSpace(); }
+	QByteArray utf8(const int start, const int length) const { return utf8(m_buffer, start, length); }
+	static QByteArray utf8(const QString &buffer, const int start, const int length)
+	{
+		return QStringRef(&buffer, start, length).toUtf8();
+	}
+	static QByteArray utf8(const QByteArray &buffer, const int start, const int length)
+	{
+		return QByteArray::fromRawData(buffer.constData() + start, length);
+	}
 
-			Invalid,
+	static const int bufferSize = 64 * 1024; // in the units of Buffer
+	QIODevice *m_device;
+	Buffer m_buffer;
+	bool m_trimmed;
+	bool m_started = false; // whether anything has been written
+	bool m_failed = false;
+};
 
-			EOD // EndOfDocument
-		} type = Invalid;
-		QVariant content;
-		QString source;
+void QGithubMarkdown::read(const QByteArray &markdown, QTextDocument *target)
+{
+	begin(target);
+	cursor.beginEditBlock();
+	insert(markdown, 0);
+	cursor.endEditBlock();
+	end();
+	QMARKDOWN_LOG(qmarkdownBuild) << "document:" << doc->toHtml();
+}
+void QGithubMarkdown::update(const QByteArray &previous, const QByteArray &markdown, QTextDocument *target)
+{
+	const int minSize = qMin(previous.size(), markdown.size());
+	int prefix = 0;
+	while (prefix < minSize && previous.at(prefix) == markdown.at(prefix))
+	{
+		++prefix;
+	}
+	if (prefix == previous.size() && prefix == markdown.size())
+	{
+		return;
+	}
+	int suffix = 0;
+	while (suffix < minSize - prefix
+		   && previous.at(previous.size() - 1 - suffix) == markdown.at(markdown.size() - 1 - suffix))
+	{
+		++suffix;
+	}
+	const int delta = markdown.size() - previous.size();
 
-		Token() {}
-		explicit Token(const Type type, const QVariant &content)
-			: type(type), content(content) {}
+	// the changed range, extended to positions at which both versions can be split
+	const QVector<int> previousSplits = splitPoints(previous);
+	const QVector<int> splits = splitPoints(markdown);
+	int start = 0;
+	int rangeEnd = previous.size();
+	for (const int split : previousSplits)
+	{
+		if (split <= prefix && std::binary_search(splits.constBegin(), splits.constEnd(), split))
+		{
+			start = split;
+		}
+		else if (split >= previous.size() - suffix && std::binary_search(splits.constBegin(), splits.constEnd(), split + delta))
+		{
+			rangeEnd = split;
+			break;
+		}
+	}
 
-		// constructor required for comparing without explicitly creating a Token
-		Token(const Type type) : type(type) {}
-		bool operator==(const Token &other)
+	// find the blocks of the changed range, and move the ones after it
+	QTextBlock first;
+	QTextBlock last;
+	for (QTextBlock block = target->begin(); block.isValid(); block = block.next())
+	{
+		QGithubMarkdownBlockData *data = static_cast<QGithubMarkdownBlockData *>(block.userData());
+		if (!data)
 		{
-			if (type == other.type && type == Character)
-			{
-				return content == other.content;
-			}
-			else
+			// not a block we inserted
+			read(markdown, target);
+			return;
+		}
+		if (data->offset >= rangeEnd)
+		{
+			data->offset += delta;
+		}
+		else if (data->offset >= start)
+		{
+			if (!first.isValid())
 			{
-				return type == other.type;
+				first = block;
 			}
+			last = block;
 		}
-	};
-	struct Paragraph
-	{
-		enum Type
-		{
-			// numbers have to match QGithubMarkdown::sizeMap
-			Heading1 = 1,
-			Heading2 = 2,
-			Heading3 = 3,
-			Heading4 = 4,
-			Heading5 = 5,
-			Heading6 = 6,
-
-			Normal,
-			Quote,
-			Code,
-
-			UnorderedList,
-			OrderedList,
-
-			FirstHeading = Heading1,
-			LastHeading = Heading6
-		} type = Normal;
-		QList<Token> tokens;
-		QList<Token> indentTokens;
-	};
-	struct List
+	}
+	if (!first.isValid())
 	{
-		QList<Paragraph> paragraphs;
-		int indent = -1;
-		bool ordered = true;
+		read(markdown, target);
+		return;
+	}
+
+	input = QByteArray::fromRawData(markdown.constData() + start, rangeEnd + delta - start);
+	const Session session = parseBlocks(input);
+	if (session.blocks.isEmpty() && !first.previous().isValid())
+	{
+		// the block after the range would have to take over the place of the first block of the document,
+		// which is as much work as reading everything
+		input.clear();
+		read(markdown, target);
+		return;
+	}
+
+	doc = target;
+	// like a load an update isn't something to undo, and recording it would grow the stack with every change
+	undoRedoEnabled = doc->isUndoRedoEnabled();
+	doc->setUndoRedoEnabled(false);
+	cursor = QTextCursor(doc);
+	cursor.beginEditBlock();
+	// if nothing replaces the blocks they go away along with the separator in front of them, which keeps the
+	// format of the block before them intact
+	cursor.setPosition(session.blocks.isEmpty() ? first.position() - 1 : first.position());
+	cursor.setPosition(last.position() + last.length() - 1, QTextCursor::KeepAnchor);
+	cursor.removeSelectedText();
+	firstBlock = true;
+	build(session, start);
+	input.clear();
+	cursor.endEditBlock();
+	end();
+}
+QSharedPointer<const QMarkdownModel> QGithubMarkdown::parse(const QByteArray &markdown, const QAtomicInt *cancelled) const
+{
+	Session session = parseBlocks(markdown, cancelled);
+	if (cancelled && cancelled->load())
+	{
+		return QSharedPointer<const QMarkdownModel>();
+	}
+	QGithubMarkdownModel *model = new QGithubMarkdownModel(markdown);
+	model->session = session;
+	return QSharedPointer<const QMarkdownModel>(model);
+}
+void QGithubMarkdown::apply(const QSharedPointer<const QMarkdownModel> &model, QTextDocument *target)
+{
+	const QGithubMarkdownModel *github = dynamic_cast<const QGithubMarkdownModel *>(model.data());
+	if (!github)
+	{
+		QAbstractMarkdown::apply(model, target);
+		return;
+	}
+	begin(target);
+	cursor.beginEditBlock();
+	input = github->markdown;
+	build(github->session, 0);
+	input.clear();
+	cursor.endEditBlock();
+	end();
+}
+quint32 QGithubMarkdown::savedSizes()
+{
+	return sizeof(Token) | (sizeof(Paragraph) << 8) | (sizeof(Block) << 16);
+}
+bool QGithubMarkdown::save(const QSharedPointer<const QMarkdownModel> &model, QIODevice *device) const
+{
+	const QGithubMarkdownModel *github = dynamic_cast<const QGithubMarkdownModel *>(model.data());
+	if (!github)
+	{
+		return false;
+	}
+	const Session &session = github->session;
+	const SavedHeader header = {{'Q', 'M', 'D', 'G'}, savedVersion, savedByteOrder, savedSizes(), github->markdown.size(),
+								qHash(github->markdown), session.tokens.size(), session.paragraphs.size(),
+								session.blocks.size(), session.listCount};
+	auto writeRaw = [device](const void *data, const qint64 size)
+	{
+		return device->write(reinterpret_cast<const char *>(data), size) == size;
 	};
+	return writeRaw(&header, sizeof(header))
+			&& writeRaw(session.tokens.constData(), qint64(session.tokens.size()) * sizeof(Token))
+			&& writeRaw(session.paragraphs.constData(), qint64(session.paragraphs.size()) * sizeof(Paragraph))
+			&& writeRaw(session.blocks.constData(), qint64(session.blocks.size()) * sizeof(Block));
+}
+QSharedPointer<const QMarkdownModel> QGithubMarkdown::load(const QByteArray &markdown, const QByteArray &data) const
+{
+	const QSharedPointer<const QMarkdownModel> invalid;
+	SavedHeader header;
+	if (data.size() < int(sizeof(header)))
+	{
+		return invalid;
+	}
+	memcpy(&header, data.constData(), sizeof(header));
+	const qint64 expectedSize = qint64(sizeof(header)) + qint64(header.tokenCount) * qint64(sizeof(Token))
+			+ qint64(header.paragraphCount) * qint64(sizeof(Paragraph)) + qint64(header.blockCount) * qint64(sizeof(Block));
+	if (memcmp(header.magic, "QMDG", 4) != 0 || header.version != savedVersion || header.byteOrder != savedByteOrder
+			|| header.sizes != savedSizes() || header.markdownSize != markdown.size() || header.markdownHash != qHash(markdown)
+			|| header.tokenCount < 0 || header.paragraphCount < 0 || header.blockCount < 0
+			|| data.size() != expectedSize)
+	{
+		return invalid;
+	}
 
-private:
-	/// Parses the markdown into tokens
-	QList<Token> tokenize(const QString &string);
-	/// Parses the list of tokens into paragraphs
-	QList<Paragraph> paragraphize(const QList<Token> &tokens);
-	/// Parses the list of paragraphs into paragraphs and lists
-	QList<QPair<Paragraph, List>> listize(const QList<Paragraph> &paragraphs);
+	QGithubMarkdownModel *model = new QGithubMarkdownModel(markdown);
+	QSharedPointer<const QMarkdownModel> out(model);
+	Session &session = model->session;
+	const char *pos = data.constData() + sizeof(header);
+	auto readRaw = [&pos](void *to, const qint64 size)
+	{
+		memcpy(to, pos, size);
+		pos += size;
+	};
+	session.tokens.resize(header.tokenCount);
+	session.paragraphs.resize(header.paragraphCount);
+	session.blocks.resize(header.blockCount);
+	session.listCount = header.listCount;
+	readRaw(session.tokens.data(), qint64(header.tokenCount) * sizeof(Token));
+	readRaw(session.paragraphs.data(), qint64(header.paragraphCount) * sizeof(Paragraph));
+	readRaw(session.blocks.data(), qint64(header.blockCount) * sizeof(Block));
 
-	static QMap<int, int> sizeMap;
-	QList<QString> codeSections;
-	QList<QString> htmlSections;
-	QTextCursor cursor;
-	QTextDocument *doc;
-	void readInlineText(const QString &data)
+	// building trusts the indices, so a damaged file must not get that far. sizes are compared to what is left
+	// rather than added up, so that nothing can overflow.
+	const int size = markdown.size();
+	for (const Token &token : session.tokens)
 	{
-		QString line = data;
-		// remove all but one space on the front
+		if (token.type > Token::Invalid || token.offset < 0 || token.offset > size || token.length < 0
+				|| token.length > size - token.offset || (token.flags & Token::Escaped && token.length < 1))
 		{
-			bool startedWithSpace = line.startsWith(' ');
-			line = line.remove(QRegularExpression("^ *"));
-			if (startedWithSpace)
+			return invalid;
+		}
+	}
+	for (const Paragraph &paragraph : session.paragraphs)
+	{
+		if (paragraph.type < Paragraph::FirstHeading || paragraph.type > Paragraph::OrderedList
+				|| paragraph.offset < 0 || paragraph.offset > size || paragraph.firstToken < 0 || paragraph.tokenCount < 0
+				|| paragraph.firstToken > session.tokens.size() || paragraph.tokenCount > session.tokens.size() - paragraph.firstToken)
+		{
+			return invalid;
+		}
+		// the spans between tokens, like the destination of a link, are measured from one token to the next
+		const Token *tokens = session.tokens.constData() + paragraph.firstToken;
+		for (int i = 1; i < paragraph.tokenCount; ++i)
+		{
+			if (tokens[i].offset < tokens[i - 1].offset + tokens[i - 1].length)
 			{
-				line = " " + line;
+				return invalid;
 			}
 		}
-		// inline code
+	}
+	if (session.listCount < 0)
+	{
+		return invalid;
+	}
+	int previousOffset = 0;
+	for (const Block &block : session.blocks)
+	{
+		if (block.firstParagraph < 0 || block.paragraphCount < 1 || block.firstParagraph > session.paragraphs.size()
+				|| block.paragraphCount > session.paragraphs.size() - block.firstParagraph)
+		{
+			return invalid;
+		}
+		// a paragraph on its own, or the items of a list which are nested no deeper than there are paragraphs
+		if (block.list == -1
+				? block.paragraphCount != 1 || block.indent != -1 || block.ordered != 0
+				: block.list < 0 || block.list >= session.listCount || block.indent < 1
+				  || block.indent > session.paragraphs.size() || (block.ordered != 0 && block.ordered != 1))
+		{
+			return invalid;
+		}
+		const Paragraph::Type itemType = block.ordered ? Paragraph::OrderedList : Paragraph::UnorderedList;
+		for (int i = block.firstParagraph; i < block.firstParagraph + block.paragraphCount; ++i)
 		{
-			QRegularExpression exp("`(.*)`");
-			QRegularExpressionMatch match = exp.match(line);
-			while (match.hasMatch())
+			const Paragraph::Type type = session.paragraphs.at(i).type;
+			if (block.list == -1 ? type == Paragraph::OrderedList || type == Paragraph::UnorderedList : type != itemType)
 			{
-				codeSections.append(match.captured(1));
-				line.replace(match.capturedStart(), match.capturedLength(), QString("$${{%1}}$$").arg(codeSections.size() - 1));
-				match = exp.match(line);
+				return invalid;
 			}
 		}
-		// link and image
+		// blockSizes() measures from one block to the next
+		const int offset = session.paragraphs.at(block.firstParagraph).offset;
+		if (offset < previousOffset)
 		{
-			QRegularExpression exp("(\\!?)\\[(.*)\\]\\((.*)\\)");
-			QRegularExpressionMatch match = exp.match(line);
-			while (match.hasMatch())
+			return invalid;
+		}
+		previousOffset = offset;
+	}
+	return out;
+}
+QVector<int> QGithubMarkdown::blockSizes(const QSharedPointer<const QMarkdownModel> &model) const
+{
+	const QGithubMarkdownModel *github = dynamic_cast<const QGithubMarkdownModel *>(model.data());
+	if (!github)
+	{
+		return QAbstractMarkdown::blockSizes(model);
+	}
+	const Session &session = github->session;
+	QVector<int> sizes(session.blocks.size());
+	for (int i = 0; i < session.blocks.size(); ++i)
+	{
+		const int start = session.paragraphs.at(session.blocks.at(i).firstParagraph).offset;
+		const int end = i + 1 < session.blocks.size()
+				? session.paragraphs.at(session.blocks.at(i + 1).firstParagraph).offset : github->markdown.size();
+		sizes[i] = end - start;
+	}
+	return sizes;
+}
+void QGithubMarkdown::applyBlocks(const QSharedPointer<const QMarkdownModel> &model, QTextDocument *target, const int first, const int count)
+{
+	const QGithubMarkdownModel *github = dynamic_cast<const QGithubMarkdownModel *>(model.data());
+	if (!github)
+	{
+		QAbstractMarkdown::applyBlocks(model, target, first, count);
+		return;
+	}
+	begin(target);
+	cursor.beginEditBlock();
+	input = github->markdown;
+	build(github->session, 0, first, count);
+	input.clear();
+	cursor.endEditBlock();
+	end();
+}
+void QGithubMarkdown::begin(QTextDocument *target)
+{
+	doc = target;
+	doc->clear();
+	// a load can't be undone anyway, and recording it costs about as much as the load itself
+	undoRedoEnabled = doc->isUndoRedoEnabled();
+	doc->setUndoRedoEnabled(false);
+	cursor = QTextCursor(doc);
+	firstBlock = true;
+	pending.clear();
+	consumed = 0;
+	splitFinder = SplitFinder();
+}
+void QGithubMarkdown::feed(const QByteArray &chunk)
+{
+	pending += chunk;
+	int split = 0;
+	splitFinder.scan(pending, [&](const int position) { split = position; });
+	if (split > 0)
+	{
+		// every chunk gets its own edit block so that the view can update in between
+		cursor.beginEditBlock();
+		insert(QByteArray::fromRawData(pending.constData(), split), consumed);
+		cursor.endEditBlock();
+		pending.remove(0, split);
+		consumed += split;
+		splitFinder.scanned -= split;
+	}
+}
+void QGithubMarkdown::finish()
+{
+	cursor.beginEditBlock();
+	insert(pending, consumed);
+	cursor.endEditBlock();
+	pending.clear();
+	end();
+}
+void QGithubMarkdown::end()
+{
+	doc->setUndoRedoEnabled(undoRedoEnabled);
+}
+QVector<QGithubMarkdown::Link> QGithubMarkdown::findLinks(const Token *tokens, const int count)
+{
+	QVector<Link> links;
+	// the starts that haven't been closed yet, the innermost one last
+	QVarLengthArray<int, 4> starts;
+	int middle = -1;
+	for (int i = 0; i < count; ++i)
+	{
+		switch (tokens[i].type)
+		{
+		case Token::LinkStart:
+		case Token::ImageStart:
+			// within the destination a [ is just a character
+			if (middle == -1)
+			{
+				starts.append(i);
+			}
+			break;
+		case Token::LinkMiddle:
+			if (!starts.isEmpty() && middle == -1)
 			{
-				if (match.captured(1) == "!")
+				middle = i;
+			}
+			break;
+		case Token::LinkEnd:
+			if (middle != -1)
+			{
+				const int start = starts.last();
+				starts.removeLast();
+				links.append(Link{start, middle, i});
+				middle = -1;
+				// an image can be the text of a link, as in a badge, but a link can't, so the starts around it are text
+				if (tokens[start].type == Token::LinkStart)
 				{
-					// FIXME this no work
-					htmlSections.append(QString("<img src=\"%1\" alt=\"%2\"/>").arg(match.captured(3), match.captured(2)));
+					starts.clear();
 				}
-				else
+			}
+			break;
+		case Token::InlineCodeDelimiter:
+			// inline code is inserted as is, so nothing in it can be part of a link
+			if (middle == -1)
+			{
+				++i;
+				while (i < count && tokens[i].type != Token::InlineCodeDelimiter)
 				{
-					htmlSections.append(QString("<a href=\"%1\">%2</a>").arg(match.captured(3), match.captured(2)));
+					++i;
 				}
-				line.replace(match.capturedStart(), match.capturedLength(), QString("$$[[%1]]$$").arg(htmlSections.size() - 1));
-				match = exp.match(line);
 			}
+			break;
+		default:
+			break;
 		}
-		QTextCharFormat fmt;
-		int numStarsOrUnderscores = 0;
-		QChar last = 0;
-		for (const QChar &c : line)
+	}
+	// an image in the text of a link is closed first, but comes after the start of the link
+	std::sort(links.begin(), links.end(), [](const Link &a, const Link &b) { return a.start < b.start; });
+	return links;
+}
+template <typename OnText, typename OnSpace, typename OnLink, typename OnImage>
+void QGithubMarkdown::walkInline(const Token *tokens, const int count, OnText onText, OnSpace onSpace, OnLink onLink,
+								 OnImage onImage)
+{
+	const QVector<Link> links = findLinks(tokens, count);
+	int nextLink = 0;
+	// the link whose text is being walked over, images in it are links of their own
+	Link openLink = {-1, -1, -1};
+	int style = PlainStyle;
+	for (int i = 0; i < count; ++i)
+	{
+		const Token &token = tokens[i];
+		if (nextLink < links.size() && links.at(nextLink).start == i)
 		{
-			if (last != c)
+			const Link &link = links.at(nextLink++);
+			const Token &middle = tokens[link.middle];
+			const int urlOffset = middle.offset + middle.length;
+			const int urlLength = tokens[link.end].offset - urlOffset;
+			if (token.type == Token::ImageStart)
 			{
-				// bold
-				if (numStarsOrUnderscores == 2)
+				const int altOffset = token.offset + token.length;
+				onImage(urlOffset, urlLength, altOffset, middle.offset - altOffset, style);
+				i = link.end;
+			}
+			else
+			{
+				// the link text follows as usual, until the middle of the link is reached
+				onLink(urlOffset, urlLength, style & ~LinkStyle);
+				style |= LinkStyle;
+				openLink = link;
+			}
+		}
+		else if (style & LinkStyle && i == openLink.middle)
+		{
+			// the destination has already been passed on at the start of the link
+			style &= ~LinkStyle;
+			i = openLink.end;
+		}
+		else if (token.type == Token::Bold)
+		{
+			style ^= BoldStyle;
+		}
+		else if (token.type == Token::Italic)
+		{
+			style ^= ItalicStyle;
+		}
+		else if (token.type == Token::InlineCodeDelimiter)
+		{
+			// everything up to the closing delimiter is taken as it was written
+			const int codeStyle = MonospaceStyle | (style & LinkStyle);
+			while (++i < count && tokens[i].type != Token::InlineCodeDelimiter)
+			{
+				const Token &code = tokens[i];
+				if (code.type == Token::NewLine)
 				{
-					if (fmt.fontWeight() == QFont::Normal)
-					{
-						fmt.setFontWeight(QFont::Bold);
-					}
-					else
-					{
-						fmt.setFontWeight(QFont::Normal);
-					}
+					onSpace(codeStyle);
 				}
-				// italic
-				else if (numStarsOrUnderscores == 1)
+				else
 				{
-					fmt.setFontItalic(!fmt.fontItalic());
+					onText(code.offset, code.length, codeStyle);
 				}
-				numStarsOrUnderscores = 0;
-				cursor.setCharFormat(fmt);
 			}
-			last = c;
-			if (c == '*' || c == '_')
+		}
+		else if (token.type == Token::NewLine)
+		{
+			onSpace(style);
+		}
+		else if (token.type == Token::Text && token.flags & Token::Escaped)
+		{
+			// without the backslash
+			onText(token.offset + 1, token.length - 1, style);
+		}
+		else
+		{
+			onText(token.offset, token.length, style);
+		}
+	}
+}
+QVector<int> QGithubMarkdown::splitPoints(const QByteArray &input)
+{
+	QVector<int> out;
+	out.append(0);
+	SplitFinder finder;
+	finder.scan(input, [&](const int position) { out.append(position); });
+	if (input.size() > 0)
+	{
+		out.append(input.size());
+	}
+	return out;
+}
+void QGithubMarkdown::insert(const QByteArray &markdown, const int offset)
+{
+	input = markdown;
+	build(parseBlocks(input), offset);
+	input.clear();
+}
+QGithubMarkdown::Session QGithubMarkdown::parseBlocks(const QByteArray &markdown, const QAtomicInt *cancelled) const
+{
+	QMARKDOWN_TIME_STAGE(ParseStage);
+	const int threads = QThread::idealThreadCount();
+	if (threads < 2 || markdown.size() < parallelThreshold)
+	{
+		return parseRange(markdown, 0, markdown.size(), cancelled);
+	}
+
+	// more parts than threads, so that a thread that gets easy parts can pick up more of them
+	const int partSize = qMax(minimumPartSize, markdown.size() / (threads * 4));
+	QList<QFuture<Session>> parts;
+	int start = 0;
+	for (const int split : splitPoints(markdown))
+	{
+		if (split - start >= partSize || (split == markdown.size() && split > start))
+		{
+			parts.append(QtConcurrent::run([this, &markdown, start, split, cancelled]()
+			{
+				return parseRange(markdown, start, split, cancelled);
+			}));
+			start = split;
+		}
+	}
+
+	// waiting runs parts that haven't been started yet on this thread, so this also works from within the pool
+	Session out;
+	for (QFuture<Session> &part : parts)
+	{
+		out.append(part.result());
+	}
+	return out;
+}
+QGithubMarkdown::Session QGithubMarkdown::parseRange(const QByteArray &markdown, const int start, const int end, const QAtomicInt *cancelled) const
+{
+	// parts that haven't been started yet when the parse is cancelled shouldn't hold up a thread of the pool
+	if (cancelled && cancelled->load())
+	{
+		return Session();
+	}
+	Session session = parseMarkdown(QByteArray::fromRawData(markdown.constData() + start, end - start), cancelled);
+	if (cancelled && cancelled->load())
+	{
+		return Session();
+	}
+	// the spans have to point into the entire markdown, which is what gets decoded when building
+	if (start > 0)
+	{
+		for (Token &token : session.tokens)
+		{
+			token.offset += start;
+		}
+		for (Paragraph &paragraph : session.paragraphs)
+		{
+			paragraph.offset += start;
+		}
+	}
+	QMARKDOWN_COUNT(BytesCounter, end - start);
+	QMARKDOWN_COUNT(TokensCounter, session.tokens.size());
+	QMARKDOWN_COUNT(ParagraphsCounter, session.paragraphs.size());
+	QMARKDOWN_COUNT(BlocksCounter, session.blocks.size());
+	QMARKDOWN_LOG(qmarkdownParse) << "parsed" << start << "to" << end << "into" << session.tokens.size() << "tokens,"
+								  << session.paragraphs.size() << "paragraphs and" << session.blocks.size() << "blocks";
+	return session;
+}
+void QGithubMarkdown::Session::append(const Session &other)
+{
+	if (tokens.isEmpty())
+	{
+		*this = other;
+		return;
+	}
+	const int tokenBase = tokens.size();
+	const int paragraphBase = paragraphs.size();
+	const int listBase = listCount;
+	tokens += other.tokens;
+	for (Paragraph paragraph : other.paragraphs)
+	{
+		paragraph.firstToken += tokenBase;
+		paragraphs.append(paragraph);
+	}
+	for (Block block : other.blocks)
+	{
+		block.firstParagraph += paragraphBase;
+		if (block.list != -1)
+		{
+			block.list += listBase;
+		}
+		blocks.append(block);
+	}
+	listCount += other.listCount;
+}
+void QGithubMarkdown::build(const Session &session, const int offset, const int first, const int count)
+{
+	QMARKDOWN_TIME_STAGE(BuildStage);
+	auto nextBlock = [&]()
+	{
+		if (!firstBlock)
+		{
+			cursor.insertBlock();
+		}
+		else
+		{
+			firstBlock = false;
+		}
+	};
+	// every block remembers where its paragraph starts, so that update() can find it
+	auto markBlocks = [&](QTextBlock block, const Paragraph &paragraph)
+	{
+		for (; block.isValid() && block.position() <= cursor.position(); block = block.next())
+		{
+			block.setUserData(new QGithubMarkdownBlockData(offset + paragraph.offset));
+		}
+	};
+
+	auto insertTokens = [&](const Paragraph &paragraph)
+	{
+		const Token *tokens = session.tokens.constData() + paragraph.firstToken;
+		const int count = paragraph.tokenCount;
+
+		// runs of text with the same format are inserted at once, every insertion goes through the undo and
+		// fragment machinery of the document
+		QString run;
+		int runStyle = PlainStyle;
+		QString href; // of the link that runs with LinkStyle are part of
+		auto flush = [&]()
+		{
+			if (run.isEmpty())
+			{
+				return;
+			}
+			if (runStyle & LinkStyle)
 			{
-				numStarsOrUnderscores++;
+				QTextCharFormat linkFormat = charFormat(paragraph.type, runStyle & ~LinkStyle);
+				linkFormat.setAnchor(true);
+				linkFormat.setAnchorHref(href);
+				linkFormat.setFontUnderline(true);
+				cursor.insertText(run, linkFormat);
 			}
 			else
 			{
-				cursor.insertText(c);
+				cursor.insertText(run, charFormat(paragraph.type, runStyle));
+			}
+			run.clear();
+		};
+		auto append = [&](const QString &str, const int style)
+		{
+			if (style != runStyle)
+			{
+				flush();
+			}
+			runStyle = style;
+			run += str;
+		};
+
+		if (paragraph.type == Paragraph::Code)
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				append(tokens[i].type == Token::NewLine ? QString('\n') : sourceText(tokens[i]), PlainStyle);
 			}
+			flush();
+			return;
 		}
-	}
-	QTextList *tryReadList(QTextList *list, const QString &line)
+
+		walkInline(tokens, count,
+				   [&](const int offset, const int length, const int style) { append(decode(offset, length), style); },
+				   // line breaks within a paragraph are rendered as spaces
+				   [&](const int style) { append(QString(' '), style); },
+				   [&](const int urlOffset, const int urlLength, const int style)
+				   {
+					   Q_UNUSED(style)
+					   flush();
+					   href = decode(urlOffset, urlLength);
+				   },
+				   [&](const int urlOffset, const int urlLength, const int altOffset, const int altLength, const int style)
+				   {
+					   QTextImageFormat imageFormat;
+					   imageFormat.setName(decode(urlOffset, urlLength));
+					   imageFormat.setToolTip(decode(altOffset, altLength));
+					   if (style & LinkStyle)
+					   {
+						   imageFormat.setAnchor(true);
+						   imageFormat.setAnchorHref(href);
+					   }
+					   flush();
+					   cursor.insertImage(imageFormat);
+				   });
+		flush();
+	};
+
+	// lists by their id in the session, an item after a nested list continues the list it belongs to
+	QHash<int, QTextList *> lists;
+	const int last = count < 0 ? session.blocks.size() : qMin(first + count, session.blocks.size());
+	for (int index = first; index < last; ++index)
 	{
-		QTextList *listOut = list;
-		QRegularExpression exp("^( *)(\\d+\\.|\\*) (.*)$");
-		QRegularExpressionMatch match = exp.match(line);
-		if (match.hasMatch())
+		const Block &item = session.blocks.at(index);
+		if (item.list == -1)
 		{
-			const int indent = match.captured(1).size() / 2 + 1;
-			const QString contents = match.captured(3);
-			const bool ordered = match.captured(2) != "*";
-			QTextListFormat fmt;
-			fmt.setStyle(ordered ? QTextListFormat::ListDecimal : QTextListFormat::ListDisc);
-			fmt.setIndent(indent);
-			if (!listOut || fmt != listOut->format())
+			const Paragraph &paragraph = session.paragraphs.at(item.firstParagraph);
+			QTextBlockFormat blockFmt;
+			blockFmt.setBottomMargin(5.0f);
+			if (paragraph.type == Paragraph::Quote)
 			{
-				listOut = cursor.insertList(fmt);
+				blockFmt.setIndent(1);
 			}
-			else
+			else if (paragraph.type == Paragraph::Code)
+			{
+				blockFmt.setNonBreakableLines(true);
+			}
+
+			nextBlock();
+			// setBlockFormat keeps the block in the list it might have been added to by insertBlock
+			if (QTextList *list = cursor.currentList())
 			{
-				cursor.insertBlock();
+				list->remove(cursor.block());
 			}
-			readInlineText(contents);
-			listOut->add(cursor.block());
-			return listOut;
+			cursor.setBlockFormat(blockFmt);
+			cursor.setBlockCharFormat(charFormat(paragraph.type, PlainStyle));
+			cursor.block().setUserState(paragraph.type);
+			const QTextBlock block = cursor.block();
+			insertTokens(paragraph);
+			markBlocks(block, paragraph);
 		}
 		else
 		{
-			return 0;
+			for (int i = item.firstParagraph; i < item.firstParagraph + item.paragraphCount; ++i)
+			{
+				const Paragraph &paragraph = session.paragraphs.at(i);
+				QTextList *list = lists.value(item.list);
+				nextBlock();
+				// the new block is in whatever list the previous one was in, which might be a nested one
+				if (QTextList *current = cursor.currentList())
+				{
+					if (current != list)
+					{
+						current->remove(cursor.block());
+					}
+				}
+				cursor.setBlockFormat(QTextBlockFormat());
+				cursor.setBlockCharFormat(QTextCharFormat());
+				if (!list)
+				{
+					QTextListFormat listFormat;
+					listFormat.setStyle(item.ordered ? QTextListFormat::ListDecimal : QTextListFormat::ListDisc);
+					listFormat.setIndent(item.indent);
+					lists.insert(item.list, cursor.createList(listFormat));
+				}
+				else if (cursor.currentList() != list)
+				{
+					list->add(cursor.block());
+				}
+				const QTextBlock block = cursor.block();
+				insertTokens(paragraph);
+				markBlocks(block, paragraph);
+			}
 		}
 	}
-	QString clean(const QString &in)
+}
+QByteArray QGithubMarkdown::write(QTextDocument *source)
+{
+	QByteArray out;
+	QBuffer buffer(&out);
+	buffer.open(QIODevice::WriteOnly);
+	write(source, &buffer);
+	return out;
+}
+bool QGithubMarkdown::write(QTextDocument *source, QIODevice *device)
+{
+	QMARKDOWN_TIME_STAGE(WriteStage);
+	QMARKDOWN_LOG(qmarkdownWrite) << "writing" << source->blockCount() << "blocks";
+	// lines are separated by a newline
+	QGithubMarkdownOutput<QString> output(device, true);
+	bool firstLine = true;
+	auto appendLine = [&]() -> QGithubMarkdownOutput<QString> &
 	{
-		QString data = in;
-		data = data.replace("\r\n", "\n").replace('\r', '\n');
-		data = data.replace("\t", "    ");
-		return data;
-	}
-	void finish()
+		if (!firstLine)
+		{
+			output += '\n';
+		}
+		firstLine = false;
+		return output;
+	};
+	bool wasInList = false;
+	bool inCodeBlock = false;
+	auto endCodeBlock = [&]()
 	{
-		for (int i = 0; i < codeSections.size(); ++i)
+		if (inCodeBlock)
 		{
-			QTextCharFormat fmt;
-			fmt.setFontFamily("Monospace");
-			doc->find(QString("$${{%1}}$$").arg(i)).insertText(codeSections.at(i), fmt);
+			appendLine() += "```\n";
+		}
+		inCodeBlock = false;
+	};
+	// walks over the fragments of the block once, markers are only written where the format changes
+	auto appendInline = [&](const QTextBlock &block)
+	{
+		bool inBold = false;
+		bool inItalic = false;
+		QString currentLink;
+		for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it)
+		{
+			const QTextFragment fragment = it.fragment();
+			if (!fragment.isValid())
+			{
+				continue;
+			}
+			const QTextCharFormat fmt = fragment.charFormat();
+			const bool bold = fmt.fontWeight() == QFont::Bold;
+			const bool italic = fmt.fontItalic();
+			const QString link = fmt.anchorHref();
+			// close what ends here from the inside out, then open what starts here from the outside in
+			if (inItalic && (!italic || bold != inBold || link != currentLink))
+			{
+				output += '_';
+				inItalic = false;
+			}
+			if (inBold && (!bold || link != currentLink))
+			{
+				output += "**";
+				inBold = false;
+			}
+			if (!currentLink.isEmpty() && link != currentLink)
+			{
+				output += "](" + currentLink + ")";
+				currentLink.clear();
+			}
+			if (!link.isEmpty() && currentLink.isEmpty())
+			{
+				output += '[';
+				currentLink = link;
+			}
+			if (fmt.isImageFormat())
+			{
+				// within the link it is in, if any
+				const QTextImageFormat image = fmt.toImageFormat();
+				output += "![" + image.toolTip() + "](" + image.name() + ")";
+				continue;
+			}
+			if (bold && !inBold)
+			{
+				output += "**";
+				inBold = true;
+			}
+			if (italic && !inItalic)
+			{
+				output += '_';
+				inItalic = true;
+			}
+			output += fragment.text();
 		}
-		for (int i = 0; i < htmlSections.size(); ++i)
+		if (inItalic)
 		{
-			doc->find(QString("$$[[%1]]$$").arg(i)).insertHtml(htmlSections.at(i));
+			output += '_';
+		}
+		if (inBold)
+		{
+			output += "**";
+		}
+		if (!currentLink.isEmpty())
+		{
+			output += "](" + currentLink + ")";
+		}
+	};
+	for (QTextBlock block = source->begin(); block != source->end(); block = block.next())
+	{
+		const QTextCharFormat blockCharFormat = block.charFormat();
+		// heading
+		if (blockCharFormat.toolTip() == block.text())
+		{
+			endCodeBlock();
+			appendLine() += QString(sizeMap.key(blockCharFormat.fontPointSize()), '#') + " " + block.text() + "\n";
+		}
+		else
+		{
+			// list
+			if (QTextList *list = block.textList())
+			{
+				endCodeBlock();
+				appendLine() += QString((list->format().indent() - 1) * 2, ' ');
+				if (list->format().style() == QTextListFormat::ListDisc)
+				{
+					output += "* ";
+				}
+				else
+				{
+					output += QString::number(list->itemNumber(block) + 1) + ". ";
+				}
+				appendInline(block);
+				wasInList = true;
+			}
+			else
+			{
+				if (wasInList)
+				{
+					appendLine();
+					wasInList = false;
+				}
+				if (blockCharFormat.fontFamily() == "Monospace")
+				{
+					if (!inCodeBlock)
+					{
+						inCodeBlock = true;
+						appendLine() += "```";
+					}
+					appendLine() += block.text().remove('\n');
+				}
+				else
+				{
+					endCodeBlock();
+					appendLine();
+					appendInline(block);
+					output += '\n';
+				}
+			}
 		}
 	}
-};
-QMap<int, int> QGithubMarkdown::sizeMap;
-
-QDebug operator<<(QDebug dbg, QGithubMarkdown::Token::Type type);
-QDebug operator<<(QDebug dbg, QGithubMarkdown::Token token);
-QDebug operator<<(QDebug dbg, QGithubMarkdown::Paragraph::Type type);
-QDebug operator<<(QDebug dbg, QGithubMarkdown::Paragraph paragraph);
+	return output.finish();
+}
 
-void QGithubMarkdown::read(const QByteArray &markdown, QTextDocument *target)
+bool QGithubMarkdown::renderHtml(const QByteArray &markdown, QIODevice *device)
 {
-	doc = target;
-	doc->clear();
-	cursor = QTextCursor(doc);
-	cursor.beginEditBlock();
-	const QList<Token> tokens = tokenize(clean(QString::fromUtf8(markdown)));
-	const QList<Paragraph> paragraphs = paragraphize(tokens);
-	const auto paralists = listize(paragraphs);
-	//std::for_each(paragraphs.begin(), paragraphs.end(), [](const Paragraph &item){qDebug() << item;});
-	bool firstBlock = true;
-	for (const auto paralist : paralists)
-	{
-		auto insertTokens = [&](const QList<Token> &tokens, const QTextCharFormat &format, const bool isCode)
-		{
-			QTextCharFormat fmt(format);
-			QTextCharFormat codeFmt(format);
-			codeFmt.setFontFamily("Monospace");
-			QListIterator<Token> iterator(tokens);
-			while (iterator.hasNext())
-			{
-				const Token token = iterator.next();
-				if (isCode)
+	const Session session = parseBlocks(markdown);
+	QMARKDOWN_TIME_STAGE(WriteStage);
+	QGithubMarkdownOutput<QByteArray> output(device);
+	const char *chars = markdown.constData();
+	auto escaped = [&](const int offset, const int length)
+	{
+		output.appendEscaped(chars + offset, length);
+	};
+
+	auto renderTokens = [&](const Paragraph &paragraph)
+	{
+		const Token *tokens = session.tokens.constData() + paragraph.firstToken;
+		const int count = paragraph.tokenCount;
+		if (paragraph.type == Paragraph::Code)
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				if (tokens[i].type == Token::NewLine)
 				{
-					cursor.insertText(token.source);
+					output += "\n";
 				}
 				else
 				{
-					if (token.type == Token::Bold)
-					{
-						if (fmt.fontWeight() == QFont::Bold)
-						{
-							fmt.setFontWeight(QFont::Normal);
-						}
-						else
-						{
-							fmt.setFontWeight(QFont::Bold);
-						}
-					}
-					else if (token.type == Token::Italic)
-					{
-						fmt.setFontItalic(!fmt.fontItalic());
-					}
-					else if (token.type == Token::InlineCodeDelimiter)
-					{
-						while (iterator.hasNext())
-						{
-							const Token next = iterator.next();
-							if (next.type == Token::InlineCodeDelimiter)
-							{
-								break;
-							}
-							else
-							{
-								cursor.insertText(token.source, codeFmt);
-							}
-						}
-					}
-					else if (token.type == Token::Character)
+					escaped(tokens[i].offset, tokens[i].length);
+				}
+			}
+			return;
+		}
+
+		// the tags that are open, from the outermost one. when the style changes only the tags from the first one
+		// that differs are closed and opened again, so that they are always properly nested.
+		static const int tagStyles[] = {LinkStyle, BoldStyle, ItalicStyle, MonospaceStyle};
+		static const char *const openTags[] = {0, "<strong>", "<em>", "<code>"};
+		static const char *const closeTags[] = {"</a>", "</strong>", "</em>", "</code>"};
+		int openStyle = PlainStyle;
+		QByteArray href; // of the link that is being rendered
+		auto setStyle = [&](const int style)
+		{
+			int first = 0;
+			while (first < 4 && (openStyle & tagStyles[first]) == (style & tagStyles[first]))
+			{
+				++first;
+			}
+			for (int tag = 3; tag >= first; --tag)
+			{
+				if (openStyle & tagStyles[tag])
+				{
+					output += closeTags[tag];
+				}
+			}
+			for (int tag = first; tag < 4; ++tag)
+			{
+				if (style & tagStyles[tag])
+				{
+					if (tag == 0)
 					{
-						cursor.insertText(token.content.toChar(), fmt);
+						output += "<a href=\"";
+						output.appendEscaped(href.constData(), href.size());
+						output += "\">";
 					}
 					else
 					{
-						cursor.insertText(token.source, fmt);
+						output += openTags[tag];
 					}
 				}
 			}
+			openStyle = style;
 		};
 
-		if (paralist.second.indent == -1)
+		walkInline(tokens, count,
+				   [&](const int offset, const int length, const int style)
+				   {
+					   setStyle(style);
+					   escaped(offset, length);
+				   },
+				   // line breaks within a paragraph are rendered as spaces
+				   [&](const int style)
+				   {
+					   setStyle(style);
+					   output += " ";
+				   },
+				   [&](const int urlOffset, const int urlLength, const int style)
+				   {
+					   // closes the link before this one, which href still belongs to
+					   setStyle(style);
+					   href = QByteArray::fromRawData(chars + urlOffset, urlLength);
+				   },
+				   [&](const int urlOffset, const int urlLength, const int altOffset, const int altLength, const int style)
+				   {
+					   setStyle(style);
+					   output += "<img src=\"";
+					   escaped(urlOffset, urlLength);
+					   output += "\" alt=\"";
+					   escaped(altOffset, altLength);
+					   output += "\"/>";
+				   });
+		setStyle(PlainStyle);
+	};
+
+	static const char *const headingTags[][2] = {{"<h1>", "</h1>\n"}, {"<h2>", "</h2>\n"}, {"<h3>", "</h3>\n"},
+												 {"<h4>", "</h4>\n"}, {"<h5>", "</h5>\n"}, {"<h6>", "</h6>\n"}};
+	// the lists that are open, innermost last, each with an item that is still open once it has one
+	struct OpenList
+	{
+		int id;
+		bool ordered;
+		bool hasItem;
+	};
+	QVector<OpenList> openLists;
+	auto closeList = [&]()
+	{
+		const OpenList &list = openLists.last();
+		output += list.hasItem ? "</li>\n" : "";
+		output += list.ordered ? "</ol>\n" : "</ul>\n";
+		openLists.removeLast();
+	};
+
+	for (const Block &item : session.blocks)
+	{
+		if (item.list == -1)
 		{
-			const Paragraph paragraph = paralist.first;
-			QTextCharFormat charFmt;
-			QTextBlockFormat blockFmt;
-			blockFmt.setBottomMargin(5.0f);
+			while (!openLists.isEmpty())
+			{
+				closeList();
+			}
+			const Paragraph &paragraph = session.paragraphs.at(item.firstParagraph);
 			if (Paragraph::FirstHeading <= paragraph.type && paragraph.type <= Paragraph::LastHeading)
 			{
-				charFmt.setFontPointSize(sizeMap[paragraph.type]);
+				output += headingTags[paragraph.type - Paragraph::FirstHeading][0];
+				renderTokens(paragraph);
+				output += headingTags[paragraph.type - Paragraph::FirstHeading][1];
 			}
 			else if (paragraph.type == Paragraph::Quote)
 			{
-				blockFmt.setIndent(1);
+				output += "<blockquote><p>";
+				renderTokens(paragraph);
+				output += "</p></blockquote>\n";
 			}
 			else if (paragraph.type == Paragraph::Code)
 			{
-				blockFmt.setNonBreakableLines(true);
-				charFmt.setFontFamily("Monospace");
-			}
-
-			if (!firstBlock)
-			{
-				cursor.insertBlock();
+				output += "<pre><code>";
+				renderTokens(paragraph);
+				output += "</code></pre>\n";
 			}
 			else
 			{
-				firstBlock = false;
+				output += "<p>";
+				renderTokens(paragraph);
+				output += "</p>\n";
 			}
-			cursor.setBlockFormat(blockFmt);
-			cursor.block().setUserState(paragraph.type);
-			insertTokens(paragraph.tokens, charFmt, paragraph.type == Paragraph::Code);
 		}
 		else
 		{
-			const List list = paralist.second;
-			qDebug() << "##########################" << list.indent << list.ordered;
-			std::for_each(list.paragraphs.begin(), list.paragraphs.end(), [](const Paragraph &item){qDebug() << item;});
-			cursor.setBlockFormat(QTextBlockFormat());
-			cursor.setBlockCharFormat(QTextCharFormat());
-			QTextListFormat listFormat;
-			listFormat.setStyle(list.ordered ? QTextListFormat::ListDecimal : QTextListFormat::ListDisc);
-			listFormat.setIndent(list.indent);
-			QTextList *l = cursor.insertList(listFormat);
-			qDebug() << "inserting list" << list.indent;
-			bool firstBlock = true;
-			for (const Paragraph &paragraph : list.paragraphs)
-			{
-				if (firstBlock)
-				{
-					firstBlock = false;
-				}
-				else
-				{
-					cursor.insertBlock();
-					qDebug() << "inserting block";
-				}
-				insertTokens(paragraph.tokens, QTextCharFormat(), false);
-				qDebug() << l->count();
-				l->add(cursor.block());
-				qDebug() << l->count();
-				qDebug() << "inserting characters";
+			// a nested list goes into the open item of the list it is nested in
+			const int level = qMax(1, item.indent);
+			while (openLists.size() > level || (openLists.size() == level && openLists.last().id != item.list))
+			{
+				closeList();
+			}
+			while (openLists.size() < level)
+			{
+				output += item.ordered ? "<ol>\n" : "<ul>\n";
+				openLists.append(OpenList{item.list, item.ordered != 0, false});
+			}
+			for (int i = item.firstParagraph; i < item.firstParagraph + item.paragraphCount; ++i)
+			{
+				output += openLists.last().hasItem ? "</li>\n<li>" : "<li>";
+				openLists.last().hasItem = true;
+				renderTokens(session.paragraphs.at(i));
 			}
 		}
 	}
-	cursor.endEditBlock();
-	qDebug() << doc->toHtml();
+	while (!openLists.isEmpty())
+	{
+		closeList();
+	}
+	return output.finish();
 }
-QByteArray QGithubMarkdown::write(QTextDocument *source)
+
+template <typename Traits>
+QGithubMarkdown::Session QGithubMarkdown::parseMarkdown(const QByteArray &data, const QAtomicInt *cancelled) const
 {
-	QStringList output;
-	bool wasInList = false;
-	bool inCodeBlock = false;
-	auto endCodeBlock = [&]()
+	typedef QMarkdownCharacterTable<Traits> Table;
+	// the input is scanned as UTF-8, all characters with a meaning in markdown are ASCII so multibyte
+	// sequences always end up in Text spans. \r\n and \r are treated as newlines, tabs as four spaces.
+	bool escapeNextCharacter = false;
+	Session session;
+	QVector<Token> &tokens = session.tokens;
+	static const QByteArray special = Table::structural();
+	const QMarkdownScanner scanner(data, special);
+	const char *chars = data.constData();
+	const int size = data.size();
+	int pos = 0;
+
+	auto peek = [&](const int offset) { return pos + offset < size ? chars[pos + offset] : '\0'; };
+	auto isSpace = [](const char c) { return Table::is(c, SpaceCharacter); };
+	auto isNewline = [](const char c) { return Table::is(c, NewlineCharacter); };
+	auto isDigit = [](const char c) { return Table::is(c, DigitCharacter); };
+	auto isLinkStart = [](const char c) { return Table::is(c, LinkStartCharacter); };
+
+	auto consumeSpace = [&]()
 	{
-		if (inCodeBlock)
+		while (pos < size && isSpace(chars[pos]))
 		{
-			output.append("```\n");
+			++pos;
 		}
-		inCodeBlock = false;
 	};
-	auto formatForPos = [&](const QTextBlock &block, const int pos) -> QTextCharFormat
+	auto consumeNewline = [&]()
 	{
-		for (const auto fmtRange : block.textFormats())
+		if (chars[pos++] == '\r' && pos < size && chars[pos] == '\n')
 		{
-			if (fmtRange.start <= pos && pos <= (fmtRange.start + fmtRange.length))
-			{
-				return fmtRange.format;
-			}
+			++pos;
 		}
-		Q_ASSERT(false);
-		return QTextCharFormat();
 	};
-	auto blockToMarkdown = [&](const QTextBlock &block, const int offset = 0) -> QString
+	auto consumeUntilNewline = [&]()
 	{
-		QString out;
-		bool inBold = false;
-		bool inItalic = false;
-		QString currentLink;
-		for (int i = offset; i < block.text().size(); ++i)
+		while (pos < size && !isNewline(chars[pos]))
 		{
-			const QChar c = block.text().at(i);
-			const QTextCharFormat fmt = formatForPos(block, i);
-			if (fmt.fontItalic() != inItalic)
-			{
-				out.insert(out.size() - 1, '_');
-				inItalic = !inItalic;
-			}
-			if ((fmt.fontWeight() == QFont::Bold) != inBold)
-			{
-				out.insert(out.size() - 1, "**");
-				inBold = !inBold;
-			}
-			if (fmt.anchorHref().isEmpty() && !currentLink.isNull())
-			{
-				out.insert(out.size() - 1, "](" + currentLink + ")");
-			}
-			else if (!fmt.anchorHref().isEmpty() && currentLink.isNull())
-			{
-				out.insert(out.size() - 1, "[");
-				currentLink = fmt.anchorHref();
-			}
-			// FIXME images
-			out.append(c);
+			++pos;
+		}
+		if (pos < size)
+		{
+			consumeNewline(); // the newline itself
 		}
-		return out;
 	};
-	for (QTextBlock block = source->begin(); block != source->end(); block = block.next())
+
+	// whether everything on the current line so far has been whitespace. kept up to date as tokens are
+	// appended, the width of that whitespace is accumulated in indent.
+	bool inLeadingSpace = true;
+	int indent = 0;
+	Token::Type previous = Token::Invalid; // of the last token, whether it was kept or not
+	bool inCode = false; // within a fenced code block
+
+	Paragraph paragraph;
+	int paragraphList = -1; // id of the list the paragraph is an item of
+	int paragraphLevel = 0; // and how deeply that list is nested
+	// the items of the current list that have been closed but not added as a block yet
+	Block list = {0, 0, -1, false, -1};
+	// the lists that an item can continue, innermost last
+	struct OpenList
 	{
-		// heading
-		if (block.charFormat().toolTip() == block.text())
+		int width; // of the indentation of the items
+		bool ordered;
+		int id;
+	};
+	QVector<OpenList> openLists;
+	// where cancelled was last looked at, which happens as paragraphs end
+	int checkedCancelled = 0;
+	bool stopped = false;
+
+	auto closeList = [&]()
+	{
+		if (list.paragraphCount > 0)
 		{
-			endCodeBlock();
-			output.append(QString(sizeMap.key(block.charFormat().fontPointSize()), '#') + " " + block.text() + "\n");
+			session.blocks.append(list);
 		}
-		else
+		list.paragraphCount = 0;
+	};
+	auto closeParagraph = [&]()
+	{
+		if (tokens.size() > paragraph.firstToken && tokens.last().type == Token::NewLine)
 		{
-			// list
-			if (QTextList *list = block.textList())
+			tokens.removeLast();
+		}
+		if (tokens.size() > paragraph.firstToken)
+		{
+			const int index = session.paragraphs.size();
+			paragraph.tokenCount = tokens.size() - paragraph.firstToken;
+			session.paragraphs.append(paragraph);
+			if (paragraphList == -1)
 			{
-				endCodeBlock();
-				const QString indent = QString((list->format().indent()-1) * 2, ' ');
-				if (list->format().style() == QTextListFormat::ListDisc)
-				{
-					output.append(indent + "* " + blockToMarkdown(block));
-				}
-				else
-				{
-					output.append(indent + QString::number(list->itemNumber(block) + 1) + ". " + blockToMarkdown(block));
-				}
-				wasInList = true;
+				// anything but a list item ends all lists
+				closeList();
+				openLists.clear();
+				session.blocks.append(Block{index, 1, -1, false, -1});
 			}
 			else
 			{
-				if (wasInList)
-				{
-					output.append("");
-					wasInList = false;
-				}
-				if (block.charFormat().fontFamily() == "Monospace")
-				{
-					if (!inCodeBlock)
-					{
-						inCodeBlock = true;
-						output.insert(output.size() - 1, "```");
-					}
-					output.append(block.text().remove("\n"));
-				}
-				else
+				if (list.paragraphCount == 0 || list.list != paragraphList)
 				{
-					endCodeBlock();
-					output.append(blockToMarkdown(block) + "\n");
+					closeList();
+					list = Block{index, 0, paragraphLevel, paragraph.type == Paragraph::OrderedList, paragraphList};
 				}
+				++list.paragraphCount;
 			}
 		}
-	}
-	QString string = output.join("\n");
-	return string.trimmed().toUtf8();
-}
-
-QList<QGithubMarkdown::Token> QGithubMarkdown::tokenize(const QString &string)
-{
-	bool escapeNextCharacter = false;
-	QList<Token> tokens;
-	QStringIterator iterator(string);
-
-	auto lastToken = [&]() { return tokens.isEmpty() ? Token() : tokens.last(); };
-	auto peekNext = [&]() { return iterator.hasNext() ? iterator.peekNext() : QChar(); };
-	auto peekNext2 = [&]()
-	{
-		const QChar next = peekNext();
-		if (next.isNull())
+		paragraph = Paragraph();
+		paragraph.firstToken = tokens.size();
+		paragraphList = -1;
+		if (cancelled && pos - checkedCancelled >= cancelCheckInterval)
 		{
-			return QChar();
+			checkedCancelled = pos;
+			stopped = cancelled->load();
 		}
-		iterator.next();
-		const QChar ret = peekNext();
-		iterator.previous(); // don't forget to undo the call to next
-		return ret;
 	};
-	auto peekPrevious = [&]() { return iterator.hasPrevious() ? iterator.peekPrevious() : QChar(); };
-	auto peekPrevious2 = [&]()
+	auto startListItem = [&](const Token &token)
 	{
-		const QChar previous = peekPrevious();
-		if (previous.isNull())
+		closeParagraph();
+		const bool ordered = token.type == Token::OrderedListStart;
+		// an item closes the lists that are nested more deeply, and continues the one with the same indentation
+		while (!openLists.isEmpty() && (openLists.last().width > indent
+										|| (openLists.last().width == indent && openLists.last().ordered != ordered)))
 		{
-			return QChar();
+			openLists.removeLast();
 		}
-		iterator.previous();
-		const QChar ret = peekPrevious();
-		iterator.next(); // don't forget to undo the call to next
-		return ret;
+		if (openLists.isEmpty() || openLists.last().width < indent)
+		{
+			openLists.append(OpenList{indent, ordered, session.listCount++});
+		}
+		paragraph.type = ordered ? Paragraph::OrderedList : Paragraph::UnorderedList;
+		paragraph.indent = indent;
+		paragraph.offset = token.offset;
+		paragraphList = openLists.last().id;
+		paragraphLevel = openLists.size();
 	};
-
-	auto consumeSpace = [&]()
+	// adds a token to the current paragraph
+	auto keep = [&](const Token &token)
 	{
-		QString out;
-		while (peekNext() == ' ')
+		// runs of characters collapse into a single span
+		if (tokens.size() > paragraph.firstToken && (token.type == Token::Text || token.type == Token::Indent)
+				&& !(token.flags & Token::Escaped))
 		{
-			out += iterator.next();
+			Token &last = tokens.last();
+			if (last.type == token.type && last.offset + last.length == token.offset)
+			{
+				last.length += token.length;
+				last.payload += token.payload;
+				return;
+			}
 		}
-		return out;
+		tokens.append(token);
 	};
-	auto consumeUntilNewline = [&]()
+	auto append = [&](const Token &token)
 	{
-		QString out;
-		while (true)
+		const bool isFirstNonSpace = inLeadingSpace;
+		inLeadingSpace = token.type == Token::NewLine || token.type == Token::Indent || token.type == Token::CodeDelimiter;
+		if (paragraph.offset < 0)
 		{
-			const QChar next = peekNext();
-			if (next == '\n' || next.isNull())
+			paragraph.offset = token.offset;
+		}
+
+		if (inCode)
+		{
+			if (token.type == Token::CodeDelimiter)
+			{
+				inCode = false;
+				closeParagraph();
+			}
+			else
 			{
-				break;
+				keep(token);
 			}
-			out += iterator.next();
 		}
-		if (iterator.hasNext())
+		else if (token.type == Token::Indent)
 		{
-			out += iterator.next(); // the newline itself
+			indent = previous == Token::Indent ? indent + token.payload : token.payload;
 		}
-		return out;
-	};
-	auto firstNonSpaceOnLine = [&]()
-	{
-		int numCharacters = 0;
-		while (peekPrevious2() == ' ' && !peekPrevious2().isNull())
+		else if (token.type == Token::NewLine && (isFirstNonSpace
+				|| (Paragraph::FirstHeading <= paragraph.type && paragraph.type <= Paragraph::LastHeading)))
+		{
+			// a line with nothing but whitespace on it is empty, and headings are a single line
+			closeParagraph();
+		}
+		else if (token.type == Token::CodeDelimiter)
+		{
+			closeParagraph();
+			paragraph.type = Paragraph::Code;
+			paragraph.offset = token.offset;
+			inCode = true;
+		}
+		else if (token.type == Token::QuoteStart && isFirstNonSpace)
+		{
+			// following lines of a quote may start with a > as well
+			if (paragraph.type != Paragraph::Quote)
+			{
+				closeParagraph();
+				paragraph.offset = token.offset;
+			}
+			paragraph.type = Paragraph::Quote;
+		}
+		else if (token.type == Token::HeadingStart && isFirstNonSpace)
+		{
+			closeParagraph();
+			paragraph.offset = token.offset;
+			paragraph.type = (Paragraph::Type)token.payload;
+		}
+		else if ((token.type == Token::UnorderedListStart || token.type == Token::OrderedListStart) && isFirstNonSpace)
+		{
+			startListItem(token);
+		}
+		else
 		{
-			numCharacters++;
-			iterator.previous();
+			// newlines within a paragraph are kept and rendered as spaces
+			keep(token);
 		}
-		bool ret = peekPrevious2().isNull() || peekPrevious2() == '\n';
-		// roll back
-		while (numCharacters > 0)
+
+		if (token.type == Token::NewLine)
 		{
-			numCharacters--;
-			iterator.next();
+			indent = 0;
 		}
-		return ret;
+		previous = token.type;
 	};
 
-	while (iterator.hasNext())
+	while (pos < size)
 	{
-		const QChar c = iterator.next();
-		Token token;
-		token.source = c;
+		// except at the start of a line only the characters found by the scanner can be anything but text,
+		// so everything up to the next one of them can be added as a single span
+		if (!escapeNextCharacter && !inLeadingSpace && !scanner.isSet(pos))
+		{
+			const int next = scanner.next(pos);
+			append(Token(Token::Text, pos, next - pos));
+			pos = next;
+			continue;
+		}
+
+		const int start = pos;
+		const char c = chars[pos++];
+		const quint16 classes = Table::classes(c);
 		if (escapeNextCharacter)
 		{
 			escapeNextCharacter = false;
-			token.type = Token::Character;
-			token.source.prepend('\\');
-			tokens.append(token);
+			Token token(Token::Text, start - 1, 2);
+			token.flags = Token::Escaped;
+			append(token);
 			continue;
 		}
-		if (c == '\\' && peekNext() != '\n') // we don't allow escaping newlines
+		if ((classes & EscapeCharacter) && !isNewline(peek(0))) // we don't allow escaping newlines
 		{
 			escapeNextCharacter = true;
 			continue;
 		}
 
-		const bool startOfParagraph = lastToken().type == Token::NewLine || lastToken().type == Token::Invalid;
-		const bool isFirstNonSpaceOnLine = startOfParagraph || firstNonSpaceOnLine();
-		if (isFirstNonSpaceOnLine && c == '#')
+		const bool startOfParagraph = previous == Token::NewLine || previous == Token::Invalid || previous == Token::CodeDelimiter;
+		const bool isFirstNonSpaceOnLine = inLeadingSpace;
+		Token token(Token::Text, start, 1);
+		if (classes == 0)
+		{
+			// plain text at the start of a line, nothing to decide
+		}
+		else if (isFirstNonSpaceOnLine && (classes & SpaceCharacter))
+		{
+			token.type = Token::Indent;
+			token.payload = c == '\t' ? 4 : 1;
+		}
+		else if (isFirstNonSpaceOnLine && (classes & HeadingCharacter))
 		{
 			int level = 1;
-			while (peekNext() == '#')
+			while (peek(0) == c)
 			{
 				level++;
-				token.source += iterator.next();
+				pos++;
+			}
+			// there are only six levels, more of them are just text
+			if (level <= Paragraph::LastHeading)
+			{
+				consumeSpace();
+				token.type = Token::HeadingStart;
+				token.payload = level;
 			}
-			token.source += consumeSpace();
-			token.type = Token::HeadingStart;
-			token.content = level;
 		}
-		else if (isFirstNonSpaceOnLine && c == '>')
+		else if (isFirstNonSpaceOnLine && (classes & QuoteCharacter))
 		{
-			token.source += consumeSpace();
+			consumeSpace();
 			token.type = Token::QuoteStart;
 		}
-		else if (startOfParagraph && c == '`' && peekNext() == '`' && peekNext2() == '`')
+		else if (startOfParagraph && (classes & CodeCharacter) && peek(0) == c && peek(1) == c)
 		{
-			token.source += iterator.next();
-			token.source += iterator.next();
-			token.source += consumeSpace();
+			pos += 2;
+			consumeSpace();
 			// TODO read the language here and add syntax highlighting?
-			token.source += consumeUntilNewline();
+			consumeUntilNewline();
 			token.type = Token::CodeDelimiter;
 		}
-		else if (isFirstNonSpaceOnLine && c == '*')
+		else if (isFirstNonSpaceOnLine && (classes & BulletCharacter))
 		{
-			token.source += consumeSpace();
+			consumeSpace();
 			token.type = Token::UnorderedListStart;
 		}
 		// one digit
-		else if (isFirstNonSpaceOnLine && c.isDigit() && peekNext() == '.')
+		else if (isFirstNonSpaceOnLine && (classes & DigitCharacter) && peek(0) == '.')
 		{
-			token.content = QString(c).toInt();
-			token.source += iterator.next();
-			token.source += consumeSpace();
+			token.payload = c - '0';
+			pos++;
+			consumeSpace();
 			token.type = Token::OrderedListStart;
 		}
 		// two digits
-		else if (isFirstNonSpaceOnLine && c.isDigit() && peekNext().isDigit() && peekNext2() == '.')
+		else if (isFirstNonSpaceOnLine && (classes & DigitCharacter) && isDigit(peek(0)) && peek(1) == '.')
 		{
-			token.content = QString(QString(c) + QString(peekNext())).toInt();
-			token.source += iterator.next();
-			token.source += iterator.next();
-			token.source += consumeSpace();
+			token.payload = (c - '0') * 10 + (peek(0) - '0');
+			pos += 2;
+			consumeSpace();
 			token.type = Token::OrderedListStart;
 		}
 		// TODO allow for numbers higher than 99?
 
-		else if ((c == '*' || c == '_') && peekNext() == c)
+		else if ((classes & EmphasisCharacter) && peek(0) == c)
 		{
-			token.source += iterator.next();
+			pos++;
 			token.type = Token::Bold;
 		}
-		else if ((c == '*' || c == '_'))
+		else if (classes & EmphasisCharacter)
 		{
 			token.type = Token::Italic;
 		}
-		else if (c == '[')
+		else if (classes & LinkStartCharacter)
 		{
 			token.type = Token::LinkStart;
 		}
-		else if (c == '!' && peekNext() == '[')
+		else if ((classes & ImageCharacter) && isLinkStart(peek(0)))
 		{
-			token.source += iterator.next();
+			pos++;
 			token.type = Token::ImageStart;
 		}
-		else if (c == ']' && peekNext() == '(')
+		else if ((classes & LinkMiddleCharacter) && peek(0) == '(')
 		{
-			token.source += iterator.next();
+			pos++;
 			token.type = Token::LinkMiddle;
 		}
-		else if (c == ')')
+		else if (classes & LinkEndCharacter)
 		{
 			token.type = Token::LinkEnd;
 		}
-		else if (c == '`')
+		else if (classes & CodeCharacter)
 		{
 			token.type = Token::InlineCodeDelimiter;
 		}
-		else if (c == '\n')
+		else if (classes & NewlineCharacter)
 		{
+			--pos;
+			consumeNewline();
 			token.type = Token::NewLine;
 		}
-		else if (c == '<')
+		else if (classes & TagCharacter)
 		{
-			token.type = peekNext() == '/' ? Token::HtmlTagClose : Token::HtmlTagOpen;
-			QString tag = "<";
-			while (true)
+			token.type = peek(0) == '/' ? Token::HtmlTagClose : Token::HtmlTagOpen;
+			// tags end at the end of the line at the latest
+			while (pos < size && chars[pos] != '>' && !isNewline(chars[pos]))
 			{
-				const QChar c = iterator.next();
-				token.source += c;
-				tag += c;
-				if (c == '>' || c.isNull())
-				{
-					break;
-				}
+				++pos;
+			}
+			if (pos < size && chars[pos] == '>')
+			{
+				++pos;
 			}
-			token.content = tag;
 		}
-		else
+
+		token.length = pos - start;
+		append(token);
+		if (stopped)
 		{
-			token.type = Token::Character;
-			token.content = c;
+			return Session();
 		}
-
-		tokens.append(token);
 	}
-	tokens.append(Token::EOD);
-	return tokens;
+	closeParagraph();
+	closeList();
+	return session;
 }
-QList<QGithubMarkdown::Paragraph> QGithubMarkdown::paragraphize(const QList<QGithubMarkdown::Token> &tokens)
+template QGithubMarkdown::Session QGithubMarkdown::parseMarkdown<QMarkdownCharacters>(const QByteArray &data, const QAtomicInt *cancelled) const;
+
+void QAbstractMarkdown::update(const QByteArray &previous, const QByteArray &markdown, QTextDocument *target)
 {
-	QList<Paragraph> out;
-	Paragraph currentParagraph;
-	QListIterator<Token> iterator(tokens);
+	Q_UNUSED(previous)
+	read(markdown, target);
+}
 
-	auto peekPreviousInternal = [&]() { return iterator.hasPrevious() ? iterator.peekPrevious() : Token(); };
-	auto peekPrevious = [&]()
-	{
-		const Token previous = peekPreviousInternal();
-		if (previous.type == Token::Invalid)
-		{
-			return Token();
-		}
-		iterator.previous();
-		const Token ret = peekPreviousInternal();
-		iterator.next(); // don't forget to undo the call to next
-		return ret;
-	};
-	auto firstNonSpaceOnLine = [&]()
-	{
-		int numTokens = 0;
-		while (peekPrevious().type == Token::Character && peekPrevious().content.toString() == " ")
-		{
-			numTokens++;
-			iterator.previous();
-		}
-		bool ret = peekPrevious().type == Token::Invalid || peekPrevious().type == Token::NewLine;
-		// roll back
-		while (numTokens > 0)
-		{
-			numTokens--;
-			iterator.next();
-		}
-		return ret;
-	};
-	auto nextParagraph = [&]()
+bool QAbstractMarkdown::write(QTextDocument *source, QIODevice *device)
+{
+	return device->write(write(source)) != -1;
+}
+bool QAbstractMarkdown::renderHtml(const QByteArray &markdown, QIODevice *device)
+{
+	QTextDocument doc;
+	read(markdown, &doc);
+	// toHtml() produces an entire page, of which only the contents of the body are wanted
+	const QString html = doc.toHtml();
+	const int body = html.indexOf("<body");
+	const int bodyStart = body == -1 ? -1 : html.indexOf('>', body) + 1;
+	const int bodyEnd = html.lastIndexOf("</body>");
+	if (bodyStart <= 0 || bodyEnd < bodyStart)
 	{
-		if (!currentParagraph.tokens.isEmpty())
-		{
-			if ((currentParagraph.tokens.last().type == Token::Character
-					&& currentParagraph.tokens.last().source == "\n")
-					|| currentParagraph.tokens.last().type == Token::NewLine)
-			{
-				currentParagraph.tokens.removeLast();
-			}
-			if (!currentParagraph.tokens.isEmpty())
-			{
-				out.append(currentParagraph);
-			}
-		}
-		currentParagraph = Paragraph();
-	};
-
-	QList<Token> spaceTokens;
-
-	while (iterator.hasNext())
+		return device->write(html.toUtf8()) != -1;
+	}
+	return device->write(html.mid(bodyStart, bodyEnd - bodyStart).trimmed().toUtf8()) != -1;
+}
+QSharedPointer<const QMarkdownModel> QAbstractMarkdown::parse(const QByteArray &markdown, const QAtomicInt *cancelled) const
+{
+	Q_UNUSED(cancelled)
+	return QSharedPointer<const QMarkdownModel>(new QMarkdownModel(markdown));
+}
+void QAbstractMarkdown::apply(const QSharedPointer<const QMarkdownModel> &model, QTextDocument *target)
+{
+	read(model->markdown, target);
+}
+QVector<int> QAbstractMarkdown::blockSizes(const QSharedPointer<const QMarkdownModel> &model) const
+{
+	return QVector<int>() << model->markdown.size();
+}
+bool QAbstractMarkdown::save(const QSharedPointer<const QMarkdownModel> &model, QIODevice *device) const
+{
+	Q_UNUSED(model)
+	Q_UNUSED(device)
+	return false;
+}
+QSharedPointer<const QMarkdownModel> QAbstractMarkdown::load(const QByteArray &markdown, const QByteArray &data) const
+{
+	Q_UNUSED(markdown)
+	Q_UNUSED(data)
+	return QSharedPointer<const QMarkdownModel>();
+}
+void QAbstractMarkdown::applyBlocks(const QSharedPointer<const QMarkdownModel> &model, QTextDocument *target, const int first, const int count)
+{
+	if (first == 0 && count > 0)
 	{
-		const Token token = iterator.next();
-		const bool isFirstNonSpace = firstNonSpaceOnLine();
-
-		if (token.type == Token::EOD)
-		{
-			break;
-		}
-		if (isFirstNonSpace && token.type == Token::Character && token.content == ' ')
-		{
-			spaceTokens += token;
-			continue;
-		}
-		if (token.type == Token::NewLine)
-		{
-			spaceTokens.clear();
-		}
-
-		if (token.type == Token::NewLine && peekPrevious().type == Token::NewLine)
-		{
-			nextParagraph();
-		}
-		else if (token.type == Token::CodeDelimiter)
-		{
-			currentParagraph.type = Paragraph::Code;
-			while (iterator.hasNext() && iterator.peekNext().type != Token::CodeDelimiter)
-			{
-				currentParagraph.tokens.append(iterator.next());
-			}
-			if (iterator.hasNext())
-			{
-				iterator.next(); // consume code end delimiter
-			}
-			nextParagraph();
-		}
-		else if (token.type == Token::QuoteStart && isFirstNonSpace)
-		{
-			currentParagraph.type = Paragraph::Quote;
-		}
-		else if (token.type == Token::HeadingStart && isFirstNonSpace)
-		{
-			currentParagraph.type = (Paragraph::Type)token.content.toInt();
-		}
-		else if (token.type == Token::UnorderedListStart && isFirstNonSpace)
-		{
-			nextParagraph();
-			currentParagraph.type = Paragraph::UnorderedList;
-			currentParagraph.indentTokens = spaceTokens;
-		}
-		else if (token.type == Token::OrderedListStart && isFirstNonSpace)
-		{
-			nextParagraph();
-			currentParagraph.type = Paragraph::OrderedList;
-			currentParagraph.indentTokens = spaceTokens;
-		}
-		else if (token.type == Token::NewLine)
-		{
-			Token token;
-			token.type = Token::Character;
-			token.source = '\n';
-			token.content = QChar(' ');
-			currentParagraph.tokens += token;
-		}
-		else
-		{
-			currentParagraph.tokens += token;
-		}
+		apply(model, target);
 	}
-
-	if (!currentParagraph.tokens.isEmpty())
+	else
 	{
-		out.append(currentParagraph);
+		target->clear();
 	}
+}
 
-	return out;
+void QAbstractMarkdown::begin(QTextDocument *target)
+{
+	m_target = target;
+	m_buffer.clear();
 }
-QList<QPair<QGithubMarkdown::Paragraph, QGithubMarkdown::List> > QGithubMarkdown::listize(const QList<QGithubMarkdown::Paragraph> &paragraphs)
+void QAbstractMarkdown::feed(const QByteArray &chunk)
 {
-	QList<QPair<Paragraph, List>> out;
-	List currentList;
-
-	auto finishList = [&]()
-	{
-		if (currentList.paragraphs.size() > 0)
-		{
-			out.append(qMakePair(Paragraph(), currentList));
-		}
-		currentList = List();
-	};
+	m_buffer += chunk;
+}
+void QAbstractMarkdown::finish()
+{
+	read(m_buffer, m_target);
+	m_buffer.clear();
+}
 
-	for (const Paragraph &paragraph : paragraphs)
-	{
-		if (paragraph.type != Paragraph::OrderedList && paragraph.type != Paragraph::UnorderedList)
-		{
-			finishList();
-			out.append(qMakePair(paragraph, List()));
-		}
-		else
-		{
-			const int indent = (paragraph.indentTokens.size() / 2) + 1;
-			if (currentList.indent != indent
-					|| currentList.ordered != (paragraph.type == Paragraph::OrderedList))
-			{
-				finishList();
-				currentList.indent = indent;
-				currentList.ordered = (paragraph.type == Paragraph::OrderedList);
-			}
-			currentList.paragraphs.append(paragraph);
-		}
-	}
-	return out;
+// the registered flavours, guarded by the mutex
+static QMutex factoriesMutex;
+static QMap<QString, QAbstractMarkdown::Factory> &factories()
+{
+	static QMap<QString, QAbstractMarkdown::Factory> factories = {{"github", []() -> QAbstractMarkdown * { return new QGithubMarkdown; }}};
+	return factories;
 }
 
+void QAbstractMarkdown::registerFlavour(const QString &id, const Factory &factory)
+{
+	QMutexLocker locker(&factoriesMutex);
+	factories().insert(id, factory);
+}
 QStringList QAbstractMarkdown::flavours()
 {
-	return QStringList() << "github";
+	QMutexLocker locker(&factoriesMutex);
+	return factories().keys();
 }
-QAbstractMarkdown *QAbstractMarkdown::flavour(const QString &id)
+QSharedPointer<QAbstractMarkdown> QAbstractMarkdown::flavour(const QString &id)
 {
-	if (id == "github")
+	Factory factory;
+	{
+		QMutexLocker locker(&factoriesMutex);
+		factory = factories().value(id);
+	}
+	Q_ASSERT(factory);
+	if (!factory)
 	{
-		return new QGithubMarkdown;
+		return QSharedPointer<QAbstractMarkdown>();
 	}
-	Q_ASSERT(false);
-	return 0;
+	return QSharedPointer<QAbstractMarkdown>(factory());
 }
 
 QDebug operator<<(QDebug dbg, QGithubMarkdown::Token::Type type)
 {
 	switch (type)
 	{
-	case QGithubMarkdown::Token::Character: dbg.nospace() << "Character"; break;
+	case QGithubMarkdown::Token::Text: dbg.nospace() << "Text"; break;
+	case QGithubMarkdown::Token::Indent: dbg.nospace() << "Indent"; break;
 	case QGithubMarkdown::Token::NewLine: dbg.nospace() << "NewLine"; break;
 	case QGithubMarkdown::Token::HeadingStart: dbg.nospace() << "HeadingStart"; break;
 	case QGithubMarkdown::Token::QuoteStart: dbg.nospace() << "QuoteStart"; break;
@@ -955,7 +1737,8 @@ QDebug operator<<(QDebug dbg, QGithubMarkdown::Token::Type type)
 }
 QDebug operator<<(QDebug dbg, QGithubMarkdown::Token token)
 {
-	dbg.nospace() << "Token(type=" << token.type << " content=" << token.content << " source=" << token.source << ")";
+	dbg.nospace() << "Token(type=" << token.type << " payload=" << token.payload
+				  << " offset=" << token.offset << " length=" << token.length << ")";
 	return dbg.maybeSpace();
 }
 QDebug operator<<(QDebug dbg, QGithubMarkdown::Paragraph::Type type)
@@ -979,16 +1762,8 @@ QDebug operator<<(QDebug dbg, QGithubMarkdown::Paragraph::Type type)
 QDebug operator<<(QDebug dbg, QGithubMarkdown::Paragraph paragraph)
 {
 	dbg.nospace() << "Paragraph(type=" << paragraph.type << "\n"
-				  << "          tokens=\n";
-	for (const QGithubMarkdown::Token &token : paragraph.tokens)
-	{
-		dbg.nospace() << "              " << token << "\n";
-	}
-	dbg.nospace() << "          indentTokens=\n";
-	for (const QGithubMarkdown::Token &token : paragraph.indentTokens)
-	{
-		dbg.nospace() << "              " << token << "\n";
-	}
+				  << "          tokens=" << paragraph.firstToken << "+" << paragraph.tokenCount << "\n";
+	dbg.nospace() << "          indent=" << paragraph.indent << "\n";
 	dbg.nospace() << ")";
 	return dbg.maybeSpace();
 }
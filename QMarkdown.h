@@ -1,6 +1,25 @@
 #pragma once
 
 #include <QTextDocument>
+#include <QIODevice>
+#include <QSharedPointer>
+#include <QAtomicInt>
+
+#include <functional>
+
+/// The result of QAbstractMarkdown::parse(), flavours subclass it to hold what they have parsed
+class QMarkdownModel
+{
+public:
+	explicit QMarkdownModel(const QByteArray &markdown) : markdown(markdown) {}
+	virtual ~QMarkdownModel() {}
+
+	/// Roughly how many bytes the model takes up in memory
+	virtual qint64 memoryUsage() const { return markdown.size(); }
+
+	/// The markdown that was parsed
+	const QByteArray markdown;
+};
 
 class QAbstractMarkdown
 {
@@ -8,10 +27,52 @@ public:
 	virtual ~QAbstractMarkdown() {}
 	virtual void read(const QByteArray &markdown, QTextDocument *target) = 0;
 	virtual QByteArray write(QTextDocument *source) = 0;
+	/// Writes the markdown for source to device as it is produced, returns false if writing to device failed
+	virtual bool write(QTextDocument *source, QIODevice *device);
+	/// Writes markdown to device as an HTML fragment, returns false if writing to device failed. The default
+	/// implementation goes through a QTextDocument, flavours can render straight from what they parse.
+	virtual bool renderHtml(const QByteArray &markdown, QIODevice *device);
+	/// Like read(), but target is expected to contain previous as read by this flavour and only the blocks
+	/// that change are replaced
+	virtual void update(const QByteArray &previous, const QByteArray &markdown, QTextDocument *target);
+
+	/// read() split into two steps: parse() doesn't touch any document and may be called from any thread,
+	/// it returns null if cancelled gets set while parsing. apply() then fills target from the result.
+	virtual QSharedPointer<const QMarkdownModel> parse(const QByteArray &markdown, const QAtomicInt *cancelled = 0) const;
+	virtual void apply(const QSharedPointer<const QMarkdownModel> &model, QTextDocument *target);
+
+	/// For filling a document a part at a time: blockSizes() returns the size of the markdown of each top level
+	/// block of the model, and applyBlocks() fills target with count of those blocks starting at first. The
+	/// default implementation treats the entire model as a single block.
+	virtual QVector<int> blockSizes(const QSharedPointer<const QMarkdownModel> &model) const;
+	virtual void applyBlocks(const QSharedPointer<const QMarkdownModel> &model, QTextDocument *target, const int first, const int count);
 
+	/// For keeping parsed markdown on disk: save() writes a model to device in a binary form, and load() turns data
+	/// written by save() back into the model of markdown without parsing it again. load() returns null if data isn't
+	/// valid for markdown. The default implementations don't support this and return false and null.
+	virtual bool save(const QSharedPointer<const QMarkdownModel> &model, QIODevice *device) const;
+	virtual QSharedPointer<const QMarkdownModel> load(const QByteArray &markdown, const QByteArray &data) const;
+
+	/// Reads markdown that arrives in pieces: begin() clears the target, feed() inserts everything that can
+	/// be inserted without seeing more of the input and finish() inserts the rest
+	virtual void begin(QTextDocument *target);
+	virtual void feed(const QByteArray &chunk);
+	virtual void finish();
+
+	typedef std::function<QAbstractMarkdown *()> Factory;
+	/// Makes a flavour available through flavour(), should be done at startup before the flavour is used
+	static void registerFlavour(const QString &id, const Factory &factory);
 	static QStringList flavours();
-	static QAbstractMarkdown *flavour(const QString &id);
+	/// A new instance of the flavour, or null if there is no such flavour. Instances are cheap, they only share
+	/// immutable tables, and each keeps its own state between begin() and finish(). parse() of an instance may
+	/// be called from other threads as well.
+	static QSharedPointer<QAbstractMarkdown> flavour(const QString &id);
 
 protected:
 	QAbstractMarkdown() {}
+
+private:
+	// used by the default implementations of begin(), feed() and finish(), which simply collect everything for read()
+	QTextDocument *m_target = 0;
+	QByteArray m_buffer;
 };
@@ -0,0 +1,327 @@
+#include <QtTest>
+#include <QTextDocument>
+#include <QBuffer>
+
+#include "QMarkdown.h"
+#include "QGithubMarkdown.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// every allocation of the process is counted, so that the stages can report how much they allocate
+static std::atomic<quint64> allocationCount(0);
+
+#if defined(__GLIBC__)
+// the containers of Qt allocate with malloc and realloc rather than operator new, so those are counted. the
+// definitions here take the place of the ones of the C library for Qt as well, and hand on to its own versions.
+static const char *const allocationName = "allocations";
+extern "C"
+{
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t count, std::size_t size);
+void *__libc_realloc(void *ptr, std::size_t size);
+
+void *malloc(std::size_t size)
+{
+	++allocationCount;
+	return __libc_malloc(size);
+}
+void *calloc(std::size_t count, std::size_t size)
+{
+	++allocationCount;
+	return __libc_calloc(count, size);
+}
+void *realloc(void *ptr, std::size_t size)
+{
+	++allocationCount;
+	return __libc_realloc(ptr, size);
+}
+}
+#else
+// elsewhere only operator new can be counted portably, which misses everything the containers of Qt allocate
+static const char *const allocationName = "operator new calls";
+
+void *operator new(std::size_t size)
+{
+	++allocationCount;
+	void *ptr = std::malloc(size ? size : 1);
+	if (!ptr)
+	{
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+void operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+#endif
+
+class QMarkdownBench : public QObject
+{
+	Q_OBJECT
+private slots:
+	void initTestCase();
+
+	void indentation_data();
+	void indentation();
+
+	void parse_data();
+	void parse();
+	void build_data();
+	void build();
+	void write_data();
+	void write();
+	void html_data();
+	void html();
+
+	void allocations_data();
+	void allocations();
+};
+
+static void quietMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+{
+	Q_UNUSED(context)
+	// in case the qmarkdown logging categories are enabled
+	if (type != QtDebugMsg)
+	{
+		fprintf(stderr, "%s\n", qPrintable(msg));
+	}
+}
+
+/// Roughly size bytes of lines with the given amount of indentation, the same size for every depth
+static QByteArray indented(const QByteArray &before, const QByteArray &after, const QByteArray &line, const int depth, const int size)
+{
+	const QByteArray indentedLine = QByteArray(depth, ' ') + line;
+	QByteArray out = before;
+	while (out.size() < size)
+	{
+		out += indentedLine;
+	}
+	return out + after;
+}
+
+/// Roughly size bytes of the pieces, repeated in order
+static QByteArray repeated(const QList<QByteArray> &pieces, const int size)
+{
+	QByteArray out;
+	out.reserve(size + 1024);
+	for (int i = 0; out.size() < size; i = (i + 1) % pieces.size())
+	{
+		out += pieces.at(i);
+	}
+	return out;
+}
+
+/// Generates roughly size bytes of the given kind of markdown
+static QByteArray corpus(const QString &kind, const int size)
+{
+	if (kind == "prose")
+	{
+		return repeated({
+							"# A heading\n\n",
+							"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et\n"
+							"dolore magna aliqua. Ut enim ad minim veniam, quis *nostrud* exercitation ullamco laboris nisi ut\n"
+							"aliquip ex ea commodo consequat. Duis aute irure dolor in **reprehenderit** in voluptate velit esse.\n\n",
+							"Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est\n"
+							"laborum. Sed ut perspiciatis unde omnis iste natus error sit voluptatem accusantium doloremque.\n\n",
+							"> Nemo enim ipsam voluptatem quia voluptas sit aspernatur aut odit aut fugit, sed quia consequuntur.\n\n"
+						}, size);
+	}
+	else if (kind == "nested lists")
+	{
+		return repeated({
+							"* first level\n",
+							"  * second level\n",
+							"    * third level with `code`\n",
+							"      1. fourth level\n",
+							"      2. fourth level\n",
+							"        * fifth level with *emphasis*\n",
+							"    * third level\n",
+							"* first level\n\n",
+							"Between lists.\n\n"
+						}, size);
+	}
+	else if (kind == "code fences")
+	{
+		return repeated({
+							"Some code:\n\n",
+							"```\n"
+							"int main(int argc, char **argv)\n"
+							"{\n"
+							"\tQApplication app(argc, argv);\n"
+							"\treturn app.exec(); // *not* emphasis\n"
+							"}\n"
+							"```\n\n"
+						}, size);
+	}
+	else if (kind == "link dense")
+	{
+		return repeated({
+							"See [the documentation](http://example.com/docs/index.html) and [the source](http://example.com/src)\n",
+							"or look at ![a screenshot](images/screenshot.png) next to [the issue tracker](http://example.com/issues).\n\n"
+						}, size);
+	}
+	else if (kind == "html heavy")
+	{
+		return repeated({
+							"<div class=\"note\">\n",
+							"<p>Some <b>bold</b> and <i>italic</i> text with a <a href=\"http://example.com\">link</a>.</p>\n",
+							"<img src=\"images/screenshot.png\" alt=\"screenshot\"/>\n",
+							"</div>\n\n"
+						}, size);
+	}
+	Q_ASSERT(false);
+	return QByteArray();
+}
+
+/// Adds a row for each kind of corpus in each size
+static void addCorpora()
+{
+	QTest::addColumn<QString>("kind");
+	QTest::addColumn<int>("size");
+
+	for (const QString kind : {"prose", "nested lists", "code fences", "link dense", "html heavy"})
+	{
+		for (const int size : {10 * 1024, 1024 * 1024, 50 * 1024 * 1024})
+		{
+			QTest::newRow(qPrintable(QString("%1, %2 KB").arg(kind).arg(size / 1024))) << kind << size;
+		}
+	}
+}
+
+void QMarkdownBench::initTestCase()
+{
+	qInstallMessageHandler(quietMessageHandler);
+}
+
+void QMarkdownBench::indentation_data()
+{
+	QTest::addColumn<QByteArray>("markdown");
+
+	// the time taken should be the same for all depths
+	for (const int depth : {2, 16, 128, 1024})
+	{
+		QTest::newRow(qPrintable(QString("code, depth %1").arg(depth)))
+				<< indented("```\n", "```\n", "int foo = bar;\n", depth, 256 * 1024);
+		QTest::newRow(qPrintable(QString("list, depth %1").arg(depth)))
+				<< indented("", "", "* item\n", depth, 256 * 1024);
+	}
+}
+void QMarkdownBench::indentation()
+{
+	QFETCH(QByteArray, markdown);
+	const QSharedPointer<QAbstractMarkdown> flavour = QAbstractMarkdown::flavour("github");
+	QBENCHMARK
+	{
+		QTextDocument doc;
+		flavour->read(markdown, &doc);
+	}
+}
+
+void QMarkdownBench::parse_data()
+{
+	addCorpora();
+}
+void QMarkdownBench::parse()
+{
+	QFETCH(QString, kind);
+	QFETCH(int, size);
+	const QByteArray markdown = corpus(kind, size);
+	QGithubMarkdown flavour;
+	QBENCHMARK
+	{
+		flavour.parseMarkdown(markdown);
+	}
+}
+
+void QMarkdownBench::build_data()
+{
+	addCorpora();
+}
+void QMarkdownBench::build()
+{
+	QFETCH(QString, kind);
+	QFETCH(int, size);
+	QGithubMarkdown flavour;
+	const QSharedPointer<const QMarkdownModel> model = flavour.parse(corpus(kind, size));
+	QTextDocument doc;
+	QBENCHMARK
+	{
+		flavour.apply(model, &doc);
+	}
+}
+
+void QMarkdownBench::write_data()
+{
+	addCorpora();
+}
+void QMarkdownBench::write()
+{
+	QFETCH(QString, kind);
+	QFETCH(int, size);
+	QGithubMarkdown flavour;
+	QTextDocument doc;
+	flavour.read(corpus(kind, size), &doc);
+	QBENCHMARK
+	{
+		flavour.write(&doc);
+	}
+}
+
+void QMarkdownBench::html_data()
+{
+	addCorpora();
+}
+void QMarkdownBench::html()
+{
+	QFETCH(QString, kind);
+	QFETCH(int, size);
+	const QByteArray markdown = corpus(kind, size);
+	QGithubMarkdown flavour;
+	QBENCHMARK
+	{
+		QBuffer buffer;
+		buffer.open(QIODevice::WriteOnly);
+		flavour.renderHtml(markdown, &buffer);
+	}
+}
+
+void QMarkdownBench::allocations_data()
+{
+	addCorpora();
+}
+void QMarkdownBench::allocations()
+{
+	QFETCH(QString, kind);
+	QFETCH(int, size);
+	const QByteArray markdown = corpus(kind, size);
+	QGithubMarkdown flavour;
+	QTextDocument doc;
+
+	quint64 before = allocationCount;
+	auto report = [&](const char *stage)
+	{
+		const quint64 after = allocationCount;
+		fprintf(stdout, "  %-12s %8.4f %s per input byte\n", stage, double(after - before) / markdown.size(), allocationName);
+		before = allocationCount;
+	};
+
+	fprintf(stdout, "%s:\n", QTest::currentDataTag());
+	QGithubMarkdownModel *model = new QGithubMarkdownModel(markdown);
+	model->session = flavour.parseMarkdown(markdown);
+	report("parse");
+	flavour.apply(QSharedPointer<const QMarkdownModel>(model), &doc);
+	report("build");
+	flavour.write(&doc);
+	report("write");
+	QBuffer buffer;
+	buffer.open(QIODevice::WriteOnly);
+	flavour.renderHtml(markdown, &buffer);
+	report("html");
+}
+
+QTEST_MAIN(QMarkdownBench)
+
+#include "QMarkdownBench.moc"
@@ -0,0 +1,236 @@
+#include "QMarkdownCache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+
+#include <limits>
+
+#include "QMarkdown.h"
+
+QMarkdownCache::QMarkdownCache(const qint64 budget)
+{
+	setBudget(budget);
+}
+
+QMarkdownCache *QMarkdownCache::global()
+{
+	static QMarkdownCache cache;
+	return &cache;
+}
+
+QMarkdownCache::Key QMarkdownCache::key(const QString &flavour, const QByteArray &markdown)
+{
+	// qHash of a QByteArray uses the CRC32 instructions where they are available
+	return qMakePair(flavour, qHash(markdown));
+}
+QString QMarkdownCache::fileName(const QString &directory, const Key &key, const int size)
+{
+	return QDir(directory).filePath(QString("%1-%2-%3.qmdcache").arg(key.first).arg(key.second, 8, 16, QChar('0')).arg(size));
+}
+
+QSharedPointer<const QMarkdownModel> QMarkdownCache::parse(const QString &flavour, const QByteArray &markdown)
+{
+	// the hash is computed once for the lookup and the insertion
+	const Key k = key(flavour, markdown);
+	QSharedPointer<const QMarkdownModel> model = find(k, flavour, markdown);
+	if (!model)
+	{
+		const QSharedPointer<QAbstractMarkdown> parser = QAbstractMarkdown::flavour(flavour);
+		if (!parser)
+		{
+			return model;
+		}
+		// parsed without holding the lock, so that other threads can use the cache in the meantime
+		model = parser->parse(markdown);
+		insert(k, flavour, model);
+	}
+	return model;
+}
+QSharedPointer<const QMarkdownModel> QMarkdownCache::find(const QString &flavour, const QByteArray &markdown)
+{
+	return find(key(flavour, markdown), flavour, markdown);
+}
+QSharedPointer<const QMarkdownModel> QMarkdownCache::find(const Key &k, const QString &flavour, const QByteArray &markdown)
+{
+	QString directory;
+	{
+		QMutexLocker locker(&m_mutex);
+		const Entry *entry = m_models.object(k);
+		// different markdown with the same hash is rare, but has to be told apart
+		if (entry && (*entry)->markdown == markdown)
+		{
+			++m_hits;
+			return *entry;
+		}
+		directory = m_directory;
+	}
+
+	if (!directory.isEmpty())
+	{
+		QFile file(fileName(directory, k, markdown.size()));
+		const QSharedPointer<QAbstractMarkdown> parser = QAbstractMarkdown::flavour(flavour);
+		const uchar *mapped = parser && file.open(QFile::ReadOnly) && file.size() > 0 ? file.map(0, file.size()) : 0;
+		// the name only tells that the hash and size match, the digest that it is really the same markdown
+		const QByteArray expected = mapped ? digest(markdown) : QByteArray();
+		if (mapped && file.size() > expected.size() && memcmp(mapped, expected.constData(), expected.size()) == 0)
+		{
+			// load() copies what it needs, so the mapping can go away afterwards
+			const Entry model = parser->load(markdown, QByteArray::fromRawData(reinterpret_cast<const char *>(mapped) + expected.size(),
+																			  file.size() - expected.size()));
+			if (model)
+			{
+				QMutexLocker locker(&m_mutex);
+				m_models.insert(k, new Entry(model), cost(model));
+				++m_hits;
+				++m_diskHits;
+				return model;
+			}
+		}
+	}
+
+	QMutexLocker locker(&m_mutex);
+	++m_misses;
+	return Entry();
+}
+void QMarkdownCache::insert(const QString &flavour, const QSharedPointer<const QMarkdownModel> &model)
+{
+	if (model)
+	{
+		insert(key(flavour, model->markdown), flavour, model);
+	}
+}
+void QMarkdownCache::insert(const Key &k, const QString &flavour, const QSharedPointer<const QMarkdownModel> &model)
+{
+	if (!model)
+	{
+		return;
+	}
+	QString directory;
+	{
+		QMutexLocker locker(&m_mutex);
+		// models that are larger than the entire budget are not kept
+		m_models.insert(k, new Entry(model), cost(model));
+		directory = m_directory;
+	}
+
+	const QSharedPointer<QAbstractMarkdown> parser = QAbstractMarkdown::flavour(flavour);
+	const QString name = directory.isEmpty() ? QString() : fileName(directory, k, model->markdown.size());
+	if (parser && !name.isEmpty() && !QFile::exists(name))
+	{
+		// written to a temporary file first, so that a partially written one is never loaded
+		QSaveFile file(name);
+		const QByteArray fileDigest = digest(model->markdown);
+		if (file.open(QFile::WriteOnly) && file.write(fileDigest) == fileDigest.size() && parser->save(model, &file)
+				&& file.commit())
+		{
+			prune(directory, diskBudget());
+		}
+	}
+}
+QByteArray QMarkdownCache::digest(const QByteArray &markdown)
+{
+	return QCryptographicHash::hash(markdown, QCryptographicHash::Sha256);
+}
+void QMarkdownCache::prune(const QString &directory, const qint64 budget)
+{
+	qint64 total = 0;
+	// newest first, so everything after the budget is used up goes
+	for (const QFileInfo &info : QDir(directory).entryInfoList(QStringList() << "*.qmdcache", QDir::Files, QDir::Time))
+	{
+		total += info.size();
+		if (total > budget)
+		{
+			QFile::remove(info.filePath());
+		}
+	}
+}
+int QMarkdownCache::cost(const Entry &model)
+{
+	return int(qMin<qint64>(model->memoryUsage() / 1024 + 1, std::numeric_limits<int>::max()));
+}
+void QMarkdownCache::clear()
+{
+	QMutexLocker locker(&m_mutex);
+	m_models.clear();
+}
+
+void QMarkdownCache::setDirectory(const QString &directory)
+{
+	if (!directory.isEmpty())
+	{
+		QDir().mkpath(directory);
+		prune(directory, diskBudget());
+	}
+	QMutexLocker locker(&m_mutex);
+	m_directory = directory;
+}
+QString QMarkdownCache::directory() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_directory;
+}
+void QMarkdownCache::setDiskBudget(const qint64 budget)
+{
+	QString directory;
+	{
+		QMutexLocker locker(&m_mutex);
+		m_diskBudget = budget;
+		directory = m_directory;
+	}
+	if (!directory.isEmpty())
+	{
+		prune(directory, budget);
+	}
+}
+qint64 QMarkdownCache::diskBudget() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_diskBudget;
+}
+
+void QMarkdownCache::setBudget(const qint64 budget)
+{
+	QMutexLocker locker(&m_mutex);
+	m_models.setMaxCost(int(qBound<qint64>(0, budget / 1024, std::numeric_limits<int>::max())));
+}
+qint64 QMarkdownCache::budget() const
+{
+	QMutexLocker locker(&m_mutex);
+	return qint64(m_models.maxCost()) * 1024;
+}
+qint64 QMarkdownCache::usage() const
+{
+	QMutexLocker locker(&m_mutex);
+	return qint64(m_models.totalCost()) * 1024;
+}
+int QMarkdownCache::count() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_models.count();
+}
+
+quint64 QMarkdownCache::hits() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_hits;
+}
+quint64 QMarkdownCache::misses() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_misses;
+}
+quint64 QMarkdownCache::diskHits() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_diskHits;
+}
+void QMarkdownCache::resetStatistics()
+{
+	QMutexLocker locker(&m_mutex);
+	m_hits = 0;
+	m_misses = 0;
+	m_diskHits = 0;
+}
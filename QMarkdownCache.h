@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QCache>
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QString>
+
+class QMarkdownModel;
+
+/// Keeps the models of recently parsed markdown, keyed by a hash of the markdown and the flavour. The least recently
+/// used models are dropped once they take up more than the budget. All functions are thread safe. As the models keep
+/// the markdown they were parsed from it must not point into memory that goes away, as by QByteArray::fromRawData.
+class QMarkdownCache
+{
+public:
+	explicit QMarkdownCache(const qint64 budget = 64 * 1024 * 1024);
+
+	/// The cache used by QMarkdownViewer unless it is given another one
+	static QMarkdownCache *global();
+
+	/// The model of markdown parsed by flavour, from the cache if it is there and parsed and added otherwise
+	QSharedPointer<const QMarkdownModel> parse(const QString &flavour, const QByteArray &markdown);
+	/// The cached model of markdown parsed by flavour, or null
+	QSharedPointer<const QMarkdownModel> find(const QString &flavour, const QByteArray &markdown);
+	void insert(const QString &flavour, const QSharedPointer<const QMarkdownModel> &model);
+	/// Drops the models kept in memory, the ones in the directory stay
+	void clear();
+
+	/// A directory to also keep the models in, through QAbstractMarkdown::save() and load(), so that they survive
+	/// restarts. Models that aren't in memory are looked for there before parsing. Empty, the default, for none.
+	/// The files are only used for exactly the markdown they were saved for.
+	void setDirectory(const QString &directory);
+	QString directory() const;
+	/// In bytes, the oldest files in the directory are removed once they take up more than this. 256 MB by default.
+	void setDiskBudget(const qint64 budget);
+	qint64 diskBudget() const;
+
+	/// In bytes, as estimated by QMarkdownModel::memoryUsage()
+	void setBudget(const qint64 budget);
+	qint64 budget() const;
+	qint64 usage() const;
+	int count() const;
+
+	quint64 hits() const;
+	quint64 misses() const;
+	/// The hits that were loaded from the directory
+	quint64 diskHits() const;
+	void resetStatistics();
+
+private:
+	typedef QPair<QString, uint> Key;
+	typedef QSharedPointer<const QMarkdownModel> Entry;
+
+	static Key key(const QString &flavour, const QByteArray &markdown);
+	/// find() and insert() for a key that has already been computed
+	QSharedPointer<const QMarkdownModel> find(const Key &k, const QString &flavour, const QByteArray &markdown);
+	void insert(const Key &k, const QString &flavour, const QSharedPointer<const QMarkdownModel> &model);
+	static QString fileName(const QString &directory, const Key &key, const int size);
+	/// For QCache, which counts in an int
+	static int cost(const Entry &model);
+	/// Identifies the markdown a file was saved for, stored in front of what the flavour saves
+	static QByteArray digest(const QByteArray &markdown);
+	/// Removes the oldest files of the directory until they take up no more than budget
+	static void prune(const QString &directory, const qint64 budget);
+
+	mutable QMutex m_mutex;
+	QCache<Key, Entry> m_models; // with the cost in KB, as QCache counts it in an int
+	quint64 m_hits = 0;
+	quint64 m_misses = 0;
+	quint64 m_diskHits = 0;
+	QString m_directory;
+	qint64 m_diskBudget = 256 * 1024 * 1024;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <QByteArray>
+
+/// Classes of the characters of the markdown source, a character can be in several of them
+enum QMarkdownCharacterClass
+{
+	NewlineCharacter = 0x1,
+	SpaceCharacter = 0x2,
+	DigitCharacter = 0x4,
+	EscapeCharacter = 0x8,
+	EmphasisCharacter = 0x10,
+	CodeCharacter = 0x20, ///< inline code, three of them start a fenced block
+	LinkStartCharacter = 0x40,
+	LinkMiddleCharacter = 0x80,
+	LinkEndCharacter = 0x100,
+	ImageCharacter = 0x200, ///< followed by the start of a link
+	TagCharacter = 0x400,
+	// the ones below only have a meaning at the start of a line
+	HeadingCharacter = 0x800,
+	QuoteCharacter = 0x1000,
+	BulletCharacter = 0x2000,
+
+	/// The classes that might start markdown syntax anywhere in a line, all other characters within a line are text
+	StructuralCharacters = NewlineCharacter | EscapeCharacter | EmphasisCharacter | CodeCharacter | LinkStartCharacter
+			| LinkMiddleCharacter | LinkEndCharacter | ImageCharacter | TagCharacter
+};
+
+/// The classes of the characters used by plain markdown, flavours can provide their own traits with a
+/// classify function like this one
+struct QMarkdownCharacters
+{
+	static constexpr quint16 classify(const char c)
+	{
+		return (c == '\n' || c == '\r' ? NewlineCharacter : 0)
+				| (c == ' ' || c == '\t' ? SpaceCharacter : 0)
+				| (c >= '0' && c <= '9' ? DigitCharacter : 0)
+				| (c == '\\' ? EscapeCharacter : 0)
+				| (c == '*' || c == '_' ? EmphasisCharacter : 0)
+				| (c == '`' ? CodeCharacter : 0)
+				| (c == '[' ? LinkStartCharacter : 0)
+				| (c == ']' ? LinkMiddleCharacter : 0)
+				| (c == ')' ? LinkEndCharacter : 0)
+				| (c == '!' ? ImageCharacter : 0)
+				| (c == '<' ? TagCharacter : 0)
+				| (c == '#' ? HeadingCharacter : 0)
+				| (c == '>' ? QuoteCharacter : 0)
+				| (c == '*' ? BulletCharacter : 0);
+	}
+};
+
+namespace QMarkdownDetail
+{
+template <int... I> struct Indices {};
+template <int N, int... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template <int... I> struct MakeIndices<0, I...> { typedef Indices<I...> Type; };
+}
+
+/// Lookup table of the classes of the ASCII characters, generated at compile time from Traits::classify. Bytes
+/// outside of ASCII are parts of multibyte UTF-8 sequences, which never have a meaning in markdown.
+template <typename Traits, typename = typename QMarkdownDetail::MakeIndices<128>::Type>
+struct QMarkdownCharacterTable;
+template <typename Traits, int... I>
+struct QMarkdownCharacterTable<Traits, QMarkdownDetail::Indices<I...>>
+{
+	static constexpr quint16 table[128] = {Traits::classify(char(I))...};
+
+	static inline quint16 classes(const char c)
+	{
+		return uchar(c) < 128 ? table[uchar(c)] : 0;
+	}
+	/// Whether c is in any of the classes
+	static inline bool is(const char c, const int classes)
+	{
+		return uchar(c) < 128 && (table[uchar(c)] & classes);
+	}
+	/// The characters in any of StructuralCharacters, for QMarkdownScanner
+	static QByteArray structural()
+	{
+		QByteArray out;
+		for (int c = 0; c < 128; ++c)
+		{
+			if (table[c] & StructuralCharacters)
+			{
+				out += char(c);
+			}
+		}
+		return out;
+	}
+};
+template <typename Traits, int... I>
+constexpr quint16 QMarkdownCharacterTable<Traits, QMarkdownDetail::Indices<I...>>::table[128];
@@ -0,0 +1,188 @@
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QMutex>
+#include <QTextDocument>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+
+#include "QMarkdown.h"
+
+/// What happened to a single input file
+struct Conversion
+{
+	QString input;
+	QString output;
+	qint64 size = 0;
+	qint64 elapsed = 0;
+	QString error;
+};
+
+/// Converts a single file, runs in one of the threads of the pool
+static Conversion convert(const QString &input, const QString &flavour, const bool html, const QString &outputDir);
+
+/// For QtConcurrent::blockingMapped, which needs to know the result type
+struct Converter
+{
+	typedef Conversion result_type;
+	QString flavour;
+	bool html;
+	QString outputDir;
+
+	Conversion operator()(const QString &input) const
+	{
+		return convert(input, flavour, html, outputDir);
+	}
+};
+
+static QMutex outputMutex;
+
+/// Reads result.input and writes result.output, sets result.error if that fails
+static void convertFile(Conversion &result, const QString &flavour, const bool html)
+{
+	QFile in(result.input);
+	if (!in.open(QFile::ReadOnly))
+	{
+		result.error = in.errorString();
+		return;
+	}
+	const QByteArray markdown = in.readAll();
+	result.size = markdown.size();
+
+	QFile out(result.output);
+	if (!out.open(QFile::WriteOnly | QFile::Truncate))
+	{
+		result.error = out.errorString();
+		return;
+	}
+	const QSharedPointer<QAbstractMarkdown> markdownFlavour = QAbstractMarkdown::flavour(flavour);
+	bool written;
+	if (html)
+	{
+		// rendered straight from the parsed markdown, without a QTextDocument in between
+		written = markdownFlavour->renderHtml(markdown, &out);
+	}
+	else
+	{
+		QTextDocument doc;
+		markdownFlavour->read(markdown, &doc);
+		written = markdownFlavour->write(&doc, &out);
+	}
+	if (!written)
+	{
+		result.error = out.errorString();
+	}
+}
+
+static Conversion convert(const QString &input, const QString &flavour, const bool html, const QString &outputDir)
+{
+	Conversion result;
+	result.input = input;
+	const QFileInfo info(input);
+	result.output = QDir(outputDir.isEmpty() ? info.absolutePath() : outputDir)
+			.filePath(info.completeBaseName() + (html ? ".html" : ".md"));
+	if (result.output == info.absoluteFilePath())
+	{
+		result.output += ".out";
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	convertFile(result, flavour, html);
+	result.elapsed = timer.nsecsElapsed();
+
+	QMutexLocker locker(&outputMutex);
+	if (result.error.isEmpty())
+	{
+		fprintf(stdout, "%s -> %s: %lld bytes in %.3f ms\n", qPrintable(input), qPrintable(result.output),
+				result.size, result.elapsed / 1e6);
+	}
+	else
+	{
+		fprintf(stderr, "%s: %s\n", qPrintable(input), qPrintable(result.error));
+	}
+	fflush(stdout);
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	// rendering into a QTextDocument needs fonts, but there might not be a display
+	if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+	{
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	}
+	QGuiApplication app(argc, argv);
+	app.setApplicationName("qmarkdown-convert");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Converts markdown files to HTML fragments or round trips them through a QTextDocument");
+	parser.addHelpOption();
+	const QCommandLineOption formatOption(QStringList() << "f" << "format", "Output format, html or markdown.", "format", "html");
+	const QCommandLineOption flavourOption("flavour", "Markdown flavour of the input.", "flavour", "github");
+	const QCommandLineOption outputOption(QStringList() << "o" << "output-dir",
+										  "Directory for the output files, next to the input if not given.", "dir");
+	const QCommandLineOption jobsOption(QStringList() << "j" << "jobs", "Number of files converted at once.", "jobs");
+	parser.addOption(formatOption);
+	parser.addOption(flavourOption);
+	parser.addOption(outputOption);
+	parser.addOption(jobsOption);
+	parser.addPositionalArgument("files", "Markdown files to convert.", "files...");
+	parser.process(app);
+
+	const QString format = parser.value(formatOption);
+	const QString flavour = parser.value(flavourOption);
+	const QString outputDir = parser.value(outputOption);
+	if (format != "html" && format != "markdown")
+	{
+		fprintf(stderr, "Unknown format %s\n", qPrintable(format));
+		return 1;
+	}
+	if (!QAbstractMarkdown::flavours().contains(flavour))
+	{
+		fprintf(stderr, "Unknown flavour %s, known are: %s\n", qPrintable(flavour),
+				qPrintable(QAbstractMarkdown::flavours().join(", ")));
+		return 1;
+	}
+	if (parser.positionalArguments().isEmpty())
+	{
+		parser.showHelp(1);
+	}
+	if (!outputDir.isEmpty() && !QDir().mkpath(outputDir))
+	{
+		fprintf(stderr, "Unable to create %s\n", qPrintable(outputDir));
+		return 1;
+	}
+	if (parser.isSet(jobsOption))
+	{
+		QThreadPool::globalInstance()->setMaxThreadCount(qMax(1, parser.value(jobsOption).toInt()));
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	const Converter converter = {flavour, format == "html", outputDir};
+	const QList<Conversion> results = QtConcurrent::blockingMapped<QList<Conversion>>(parser.positionalArguments(), converter);
+	const qint64 elapsed = timer.nsecsElapsed();
+
+	qint64 total = 0;
+	int failed = 0;
+	for (const Conversion &result : results)
+	{
+		total += result.size;
+		if (!result.error.isEmpty())
+		{
+			failed++;
+		}
+	}
+	fprintf(stdout, "%d files, %lld bytes in %.3f ms, %.2f MB/s\n", results.size(), total, elapsed / 1e6,
+			elapsed ? (total / (1024.0 * 1024.0)) / (elapsed / 1e9) : 0.0);
+	if (failed)
+	{
+		fprintf(stderr, "%d files failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
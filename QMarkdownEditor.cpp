@@ -49,7 +49,23 @@ void QMarkdownEditor::setMarkdown(const QString &flavour, const QByteArray &data
 {
 	m_viewer->setMarkdown(flavour, data);
 }
+void QMarkdownEditor::setMarkdownInBackground(const QString &flavour, const QByteArray &data)
+{
+	m_viewer->setMarkdownInBackground(flavour, data);
+}
+void QMarkdownEditor::setMarkdownLazily(const QString &flavour, const QByteArray &data)
+{
+	m_viewer->setMarkdownLazily(flavour, data);
+}
+bool QMarkdownEditor::setMarkdownFile(const QString &flavour, const QString &path, const bool lazily)
+{
+	return m_viewer->setMarkdownFile(flavour, path, lazily);
+}
 QByteArray QMarkdownEditor::getMarkdown(const QString &flavour)
 {
 	return m_viewer->getMarkdown(flavour);
 }
+bool QMarkdownEditor::writeMarkdown(const QString &flavour, QIODevice *device)
+{
+	return m_viewer->writeMarkdown(flavour, device);
+}
@@ -5,6 +5,7 @@
 class QMarkdownViewer;
 class QToolBar;
 class QAction;
+class QIODevice;
 
 class QMarkdownEditor : public QWidget
 {
@@ -13,7 +14,11 @@ public:
 	QMarkdownEditor(QWidget *parent = 0);
 
 	void setMarkdown(const QString &flavour, const QByteArray &data);
+	void setMarkdownInBackground(const QString &flavour, const QByteArray &data);
+	void setMarkdownLazily(const QString &flavour, const QByteArray &data);
+	bool setMarkdownFile(const QString &flavour, const QString &path, const bool lazily = false);
 	QByteArray getMarkdown(const QString &flavour);
+	bool writeMarkdown(const QString &flavour, QIODevice *device);
 
 private:
 	QMarkdownViewer *m_viewer;
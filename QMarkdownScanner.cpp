@@ -0,0 +1,145 @@
+#include "QMarkdownScanner.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QMARKDOWN_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(QMARKDOWN_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QMARKDOWN_AVX2
+#include <immintrin.h>
+#endif
+
+static inline int countTrailingZeros(const quint64 value)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(value);
+#else
+	int count = 0;
+	while (!(value & (Q_UINT64_C(1) << count)))
+	{
+		count++;
+	}
+	return count;
+#endif
+}
+
+bool QMarkdownScanner::isSpecial(const char c) const
+{
+	return uchar(c) < 128 && ((m_special[uchar(c) >> 6] >> (uchar(c) & 63)) & 1);
+}
+
+/// Fills the bitmap for size bytes of data, bits needs to have room for all of them
+void QMarkdownScanner::scanScalar(const char *data, const int size, quint64 *bits) const
+{
+	for (int i = 0; i < size; ++i)
+	{
+		if (isSpecial(data[i]))
+		{
+			bits[i >> 6] |= Q_UINT64_C(1) << (i & 63);
+		}
+	}
+}
+
+// the vectorized versions compare against each of the special characters
+#ifdef QMARKDOWN_SSE2
+static inline __m128i specialMask(const __m128i chunk, const __m128i *specials, const int count)
+{
+	__m128i mask = _mm_setzero_si128();
+	for (int i = 0; i < count; ++i)
+	{
+		mask = _mm_or_si128(mask, _mm_cmpeq_epi8(chunk, specials[i]));
+	}
+	return mask;
+}
+static int scanSse2(const char *data, const int size, quint64 *bits, const QByteArray &special)
+{
+	__m128i specials[128];
+	for (int i = 0; i < special.size(); ++i)
+	{
+		specials[i] = _mm_set1_epi8(special.at(i));
+	}
+	int pos = 0;
+	for (; pos + 64 <= size; pos += 64)
+	{
+		quint64 word = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + i * 16));
+			word |= quint64(quint16(_mm_movemask_epi8(specialMask(chunk, specials, special.size())))) << (i * 16);
+		}
+		bits[pos >> 6] = word;
+	}
+	return pos;
+}
+#endif
+
+#ifdef QMARKDOWN_AVX2
+__attribute__((target("avx2"))) static inline __m256i specialMaskAvx2(const __m256i chunk, const __m256i *specials, const int count)
+{
+	__m256i mask = _mm256_setzero_si256();
+	for (int i = 0; i < count; ++i)
+	{
+		mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(chunk, specials[i]));
+	}
+	return mask;
+}
+__attribute__((target("avx2"))) static int scanAvx2(const char *data, const int size, quint64 *bits, const QByteArray &special)
+{
+	__m256i specials[128];
+	for (int i = 0; i < special.size(); ++i)
+	{
+		specials[i] = _mm256_set1_epi8(special.at(i));
+	}
+	int pos = 0;
+	for (; pos + 64 <= size; pos += 64)
+	{
+		const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+		const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + 32));
+		bits[pos >> 6] = quint64(quint32(_mm256_movemask_epi8(specialMaskAvx2(low, specials, special.size()))))
+				| (quint64(quint32(_mm256_movemask_epi8(specialMaskAvx2(high, specials, special.size())))) << 32);
+	}
+	return pos;
+}
+#endif
+
+QMarkdownScanner::QMarkdownScanner(const QByteArray &data, const QByteArray &special)
+	: m_bits((data.size() >> 6) + 1, 0), m_size(data.size())
+{
+	m_special[0] = m_special[1] = 0;
+	for (const char c : special)
+	{
+		Q_ASSERT(uchar(c) < 128);
+		m_special[uchar(c) >> 6] |= Q_UINT64_C(1) << (uchar(c) & 63);
+	}
+
+	const char *chars = data.constData();
+	quint64 *bits = m_bits.data();
+	int done = 0;
+#if defined(QMARKDOWN_AVX2)
+	static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+	done = hasAvx2 ? scanAvx2(chars, m_size, bits, special) : scanSse2(chars, m_size, bits, special);
+#elif defined(QMARKDOWN_SSE2)
+	done = scanSse2(chars, m_size, bits, special);
+#endif
+	// the remainder that doesn't fill an entire word, or everything if there is no vectorized version
+	scanScalar(chars + done, m_size - done, bits + (done >> 6));
+}
+
+int QMarkdownScanner::next(const int pos) const
+{
+	if (pos >= m_size)
+	{
+		return m_size;
+	}
+	int word = pos >> 6;
+	quint64 bits = m_bits.at(word) & (~Q_UINT64_C(0) << (pos & 63));
+	while (bits == 0)
+	{
+		if (++word >= m_bits.size())
+		{
+			return m_size;
+		}
+		bits = m_bits.at(word);
+	}
+	return qMin((word << 6) + countTrailingZeros(bits), m_size);
+}
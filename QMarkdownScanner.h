@@ -0,0 +1,30 @@
+#pragma once
+
+#include <QByteArray>
+#include <QVector>
+
+/// Bitmap of the positions in an UTF-8 buffer that hold characters which might start markdown syntax
+class QMarkdownScanner
+{
+public:
+	/// special are the ASCII characters that might start markdown syntax
+	QMarkdownScanner(const QByteArray &data, const QByteArray &special);
+
+	/// Whether the character at pos might start markdown syntax
+	inline bool isSet(const int pos) const
+	{
+		return (m_bits.at(pos >> 6) >> (pos & 63)) & 1;
+	}
+	/// Returns the first position at or after pos that might start markdown syntax, or the size of the data if there is none
+	int next(const int pos) const;
+
+	/// Whether c is one of the special characters, which are recorded in the bitmap
+	bool isSpecial(const char c) const;
+
+private:
+	void scanScalar(const char *data, const int size, quint64 *bits) const;
+
+	quint64 m_special[2]; // bitmap of the special characters
+	QVector<quint64> m_bits;
+	int m_size;
+};
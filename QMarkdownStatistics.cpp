@@ -0,0 +1,60 @@
+#include "QMarkdownStatistics.h"
+
+#include <atomic>
+
+Q_LOGGING_CATEGORY(qmarkdownParse, "qmarkdown.parse", QtWarningMsg)
+Q_LOGGING_CATEGORY(qmarkdownBuild, "qmarkdown.build", QtWarningMsg)
+Q_LOGGING_CATEGORY(qmarkdownWrite, "qmarkdown.write", QtWarningMsg)
+
+static std::atomic<bool> enabled(false);
+static std::atomic<qint64> elapsedTimes[QMarkdownStatistics::StageCount];
+static std::atomic<quint64> runCounts[QMarkdownStatistics::StageCount];
+static std::atomic<quint64> counters[QMarkdownStatistics::CounterCount];
+
+void QMarkdownStatistics::setEnabled(const bool enable)
+{
+#ifdef QMARKDOWN_TRACE
+	enabled = enable;
+#else
+	Q_UNUSED(enable)
+#endif
+}
+bool QMarkdownStatistics::isEnabled()
+{
+	return enabled.load(std::memory_order_relaxed);
+}
+void QMarkdownStatistics::reset()
+{
+	for (int i = 0; i < StageCount; ++i)
+	{
+		elapsedTimes[i] = 0;
+		runCounts[i] = 0;
+	}
+	for (int i = 0; i < CounterCount; ++i)
+	{
+		counters[i] = 0;
+	}
+}
+
+qint64 QMarkdownStatistics::elapsed(const Stage stage)
+{
+	return elapsedTimes[stage];
+}
+quint64 QMarkdownStatistics::runs(const Stage stage)
+{
+	return runCounts[stage];
+}
+quint64 QMarkdownStatistics::count(const Counter counter)
+{
+	return counters[counter];
+}
+
+void QMarkdownStatistics::add(const Stage stage, const qint64 nanoseconds)
+{
+	elapsedTimes[stage].fetch_add(nanoseconds, std::memory_order_relaxed);
+	runCounts[stage].fetch_add(1, std::memory_order_relaxed);
+}
+void QMarkdownStatistics::add(const Counter counter, const quint64 amount)
+{
+	counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QtGlobal>
+#include <QLoggingCategory>
+
+// tracing is compiled in for debug builds, or if asked for explicitly
+#if (!defined(QT_NO_DEBUG) || defined(QMARKDOWN_FORCE_TRACE)) && !defined(QMARKDOWN_NO_TRACE)
+#define QMARKDOWN_TRACE
+#endif
+
+Q_DECLARE_LOGGING_CATEGORY(qmarkdownParse)
+Q_DECLARE_LOGGING_CATEGORY(qmarkdownBuild)
+Q_DECLARE_LOGGING_CATEGORY(qmarkdownWrite)
+
+/// Timers and counters of the stages of converting markdown, summed over all threads. They are only collected
+/// after setEnabled(true), and are always zero if the library was built without QMARKDOWN_TRACE.
+class QMarkdownStatistics
+{
+public:
+	enum Stage
+	{
+		ParseStage,
+		BuildStage,
+		WriteStage,
+		StageCount
+	};
+	enum Counter
+	{
+		BytesCounter, ///< of markdown parsed
+		TokensCounter,
+		ParagraphsCounter,
+		BlocksCounter,
+		CounterCount
+	};
+
+	static void setEnabled(const bool enabled);
+	static bool isEnabled();
+	static void reset();
+
+	/// Time spent in the stage, in nanoseconds
+	static qint64 elapsed(const Stage stage);
+	/// How often the stage has been run
+	static quint64 runs(const Stage stage);
+	static quint64 count(const Counter counter);
+
+	static void add(const Stage stage, const qint64 nanoseconds);
+	static void add(const Counter counter, const quint64 amount);
+};
+
+#ifdef QMARKDOWN_TRACE
+#include <QElapsedTimer>
+
+/// Adds the time from its construction to its destruction to a stage
+class QMarkdownStageTimer
+{
+public:
+	explicit QMarkdownStageTimer(const QMarkdownStatistics::Stage stage)
+		: m_stage(stage), m_enabled(QMarkdownStatistics::isEnabled())
+	{
+		if (m_enabled)
+		{
+			m_timer.start();
+		}
+	}
+	~QMarkdownStageTimer()
+	{
+		if (m_enabled)
+		{
+			QMarkdownStatistics::add(m_stage, m_timer.nsecsElapsed());
+		}
+	}
+
+private:
+	QMarkdownStatistics::Stage m_stage;
+	bool m_enabled;
+	QElapsedTimer m_timer;
+};
+
+#define QMARKDOWN_TIME_STAGE(stage) const QMarkdownStageTimer qmarkdownStageTimer(QMarkdownStatistics::stage)
+#define QMARKDOWN_COUNT(counter, amount) \
+	do { if (QMarkdownStatistics::isEnabled()) QMarkdownStatistics::add(QMarkdownStatistics::counter, (amount)); } while (false)
+#define QMARKDOWN_LOG(category) qCDebug(category)
+#else
+#define QMARKDOWN_TIME_STAGE(stage) do {} while (false)
+#define QMARKDOWN_COUNT(counter, amount) do {} while (false)
+#define QMARKDOWN_LOG(category) while (false) QMessageLogger().noDebug()
+#endif
@@ -0,0 +1,167 @@
+#include <QtTest>
+#include <QBuffer>
+#include <QTextDocument>
+
+#include "QMarkdown.h"
+
+static QByteArray renderHtml(const QByteArray &markdown)
+{
+	QBuffer buffer;
+	buffer.open(QBuffer::WriteOnly);
+	if (!QAbstractMarkdown::flavour("github")->renderHtml(markdown, &buffer))
+	{
+		return QByteArray();
+	}
+	return buffer.data();
+}
+
+class QMarkdownTest : public QObject
+{
+	Q_OBJECT
+private slots:
+	void update_data();
+	void update();
+	void feed_data();
+	void feed();
+	void parallel_data();
+	void parallel();
+	void links_data();
+	void links();
+	void headings_data();
+	void headings();
+};
+
+void QMarkdownTest::update_data()
+{
+	QTest::addColumn<QByteArray>("previous");
+	QTest::addColumn<QByteArray>("markdown");
+
+	QTest::newRow("insert paragraph") << QByteArray("a\n\nc") << QByteArray("a\n\nb\n\nc");
+	QTest::newRow("insert at end") << QByteArray("a\n\nb") << QByteArray("a\n\nb\n\nc");
+	QTest::newRow("delete paragraph") << QByteArray("a\n\nb\n\nc") << QByteArray("a\n\nc");
+	QTest::newRow("delete last paragraph") << QByteArray("a\n\nb\n\nc") << QByteArray("a\n\nb");
+	QTest::newRow("delete first paragraph") << QByteArray("a\n\nb\n\nc") << QByteArray("b\n\nc");
+	QTest::newRow("delete everything") << QByteArray("a\n\nb") << QByteArray();
+	QTest::newRow("edit text") << QByteArray("a\n\nsome text\n\nc") << QByteArray("a\n\nsome *more* text\n\nc");
+	QTest::newRow("edit heading") << QByteArray("# a\n\nb\n\nc") << QByteArray("## a\n\nb\n\nc");
+	QTest::newRow("edit list item") << QByteArray("a\n\n* one\n* two\n\nc") << QByteArray("a\n\n* one\n* three\n\nc");
+	QTest::newRow("edit code") << QByteArray("a\n\n```\nint a;\n```\n\nc") << QByteArray("a\n\n```\nint b;\n```\n\nc");
+}
+void QMarkdownTest::update()
+{
+	QFETCH(QByteArray, previous);
+	QFETCH(QByteArray, markdown);
+	const QSharedPointer<QAbstractMarkdown> flavour = QAbstractMarkdown::flavour("github");
+
+	QTextDocument updated;
+	flavour->read(previous, &updated);
+	flavour->update(previous, markdown, &updated);
+	QTextDocument read;
+	flavour->read(markdown, &read);
+
+	QCOMPARE(updated.toHtml(), read.toHtml());
+	// updates aren't recorded for undo
+	QVERIFY(!updated.isUndoAvailable());
+	QVERIFY(updated.isUndoRedoEnabled());
+}
+
+void QMarkdownTest::feed_data()
+{
+	QTest::addColumn<QByteArray>("markdown");
+
+	QTest::newRow("paragraphs") << QByteArray("a\n\nb\n\nc\n");
+	QTest::newRow("whitespace between paragraphs") << QByteArray("a\n   \nb\n");
+	QTest::newRow("whitespace between items") << QByteArray("* a\n\n   \n* b\n");
+	QTest::newRow("whitespace between numbered items") << QByteArray("1. a\n\n \t\n2. b\n3. c\n");
+	QTest::newRow("nested list") << QByteArray("* a\n  * b\n\n* c\n");
+	QTest::newRow("empty lines in code") << QByteArray("a\n\n```\nx\n\n\ny\n```\n\nb\n");
+	QTest::newRow("quote") << QByteArray("> a\n> b\n\nc\n");
+}
+void QMarkdownTest::feed()
+{
+	QFETCH(QByteArray, markdown);
+	const QSharedPointer<QAbstractMarkdown> flavour = QAbstractMarkdown::flavour("github");
+
+	QTextDocument read;
+	flavour->read(markdown, &read);
+	// small chunks make feed() insert at almost every position at which the input can be split
+	for (const int chunkSize : {1, 3, 16})
+	{
+		QTextDocument fed;
+		flavour->begin(&fed);
+		for (int i = 0; i < markdown.size(); i += chunkSize)
+		{
+			flavour->feed(markdown.mid(i, chunkSize));
+		}
+		flavour->finish();
+		QCOMPARE(fed.toHtml(), read.toHtml());
+	}
+}
+void QMarkdownTest::parallel_data()
+{
+	feed_data();
+}
+void QMarkdownTest::parallel()
+{
+	QFETCH(QByteArray, markdown);
+	const QSharedPointer<QAbstractMarkdown> flavour = QAbstractMarkdown::flavour("github");
+
+	// large enough to be parsed in parts, above QGithubMarkdown::parallelThreshold
+	QByteArray large;
+	while (large.size() < 512 * 1024)
+	{
+		large += markdown + "\n";
+	}
+	QTextDocument read;
+	flavour->read(large, &read);
+	// fed in chunks that are each parsed in one go
+	QTextDocument fed;
+	flavour->begin(&fed);
+	for (int i = 0; i < large.size(); i += 4096)
+	{
+		flavour->feed(large.mid(i, 4096));
+	}
+	flavour->finish();
+	QCOMPARE(read.toHtml(), fed.toHtml());
+}
+void QMarkdownTest::links_data()
+{
+	QTest::addColumn<QByteArray>("markdown");
+	QTest::addColumn<QByteArray>("html");
+
+	QTest::newRow("link") << QByteArray("[text](url)") << QByteArray("<p><a href=\"url\">text</a></p>\n");
+	QTest::newRow("image") << QByteArray("![alt](img)") << QByteArray("<p><img src=\"img\" alt=\"alt\"/></p>\n");
+	QTest::newRow("image in link") << QByteArray("[![alt](img)](url)")
+								   << QByteArray("<p><a href=\"url\"><img src=\"img\" alt=\"alt\"/></a></p>\n");
+	QTest::newRow("image and text in link") << QByteArray("[a ![alt](img) b](url)")
+											<< QByteArray("<p><a href=\"url\">a <img src=\"img\" alt=\"alt\"/> b</a></p>\n");
+	QTest::newRow("link in link") << QByteArray("[a [b](inner) c](outer)")
+								  << QByteArray("<p>[a <a href=\"inner\">b</a> c](outer)</p>\n");
+}
+void QMarkdownTest::links()
+{
+	QFETCH(QByteArray, markdown);
+	QFETCH(QByteArray, html);
+	QCOMPARE(renderHtml(markdown), html);
+}
+
+void QMarkdownTest::headings_data()
+{
+	QTest::addColumn<QByteArray>("markdown");
+	QTest::addColumn<QByteArray>("html");
+
+	QTest::newRow("level 1") << QByteArray("# a") << QByteArray("<h1>a</h1>\n");
+	QTest::newRow("level 6") << QByteArray("###### a") << QByteArray("<h6>a</h6>\n");
+	QTest::newRow("level 7") << QByteArray("####### a") << QByteArray("<p>####### a</p>\n");
+	QTest::newRow("level 12") << QByteArray("############ a") << QByteArray("<p>############ a</p>\n");
+}
+void QMarkdownTest::headings()
+{
+	QFETCH(QByteArray, markdown);
+	QFETCH(QByteArray, html);
+	QCOMPARE(renderHtml(markdown), html);
+}
+
+QTEST_MAIN(QMarkdownTest)
+
+#include "QMarkdownTest.moc"
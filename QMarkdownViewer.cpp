@@ -1,17 +1,277 @@
 #include "QMarkdownViewer.h"
 
+#include <QFile>
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
+#include <QScrollBar>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextList>
+
+#include <algorithm>
+#include <limits>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
 #include "QMarkdown.h"
+#include "QMarkdownCache.h"
+
+// the amount of top level blocks that is put into the document at once by setMarkdownLazily
+static const int lazyWindowSize = 200;
 
 QMarkdownViewer::QMarkdownViewer(QWidget *parent)
-	: QTextEdit(parent)
+	: QTextEdit(parent), m_cache(QMarkdownCache::global())
 {
+	connect(verticalScrollBar(), &QScrollBar::valueChanged, [this]()
+	{
+		materialize();
+	});
 }
 
 void QMarkdownViewer::setMarkdown(const QString &flavour, const QByteArray &data)
 {
-	QAbstractMarkdown::flavour(flavour)->read(data, document());
+	// a background parse that is still running would replace this once it finishes
+	if (m_cancelParse)
+	{
+		m_cancelParse->store(1);
+		m_cancelParse.reset();
+	}
+	resetLazy();
+	const QSharedPointer<QAbstractMarkdown> markdown = QAbstractMarkdown::flavour(flavour);
+	// if the document hasn't been edited since the last call only the changed blocks need to be replaced, which
+	// doesn't go through the cache as only those blocks are parsed
+	if (flavour == m_flavour && document()->revision() == m_revision)
+	{
+		markdown->update(m_markdown, data, document());
+	}
+	else
+	{
+		markdown->apply(parse(flavour, data), document());
+	}
+	m_flavour = flavour;
+	m_markdown = data;
+	m_file.reset();
+	m_revision = document()->revision();
+}
+void QMarkdownViewer::setMarkdownInBackground(const QString &flavour, const QByteArray &data)
+{
+	if (m_cancelParse)
+	{
+		m_cancelParse->store(1);
+	}
+	const QSharedPointer<QAtomicInt> cancelled(new QAtomicInt(0));
+	m_cancelParse = cancelled;
+	resetLazy();
+
+	typedef QSharedPointer<const QMarkdownModel> Model;
+	const QSharedPointer<QAbstractMarkdown> markdown = QAbstractMarkdown::flavour(flavour);
+	QFutureWatcher<Model> *watcher = new QFutureWatcher<Model>(this);
+	connect(watcher, &QFutureWatcherBase::finished, [this, watcher, markdown, cancelled, flavour, data]()
+	{
+		watcher->deleteLater();
+		const Model model = watcher->result();
+		if (cancelled->load() || !model)
+		{
+			return;
+		}
+		markdown->apply(model, document());
+		m_flavour = flavour;
+		m_markdown = data;
+		m_file.reset();
+		m_revision = document()->revision();
+		emit markdownLoaded();
+	});
+	QMarkdownCache *cache = m_cache;
+	watcher->setFuture(QtConcurrent::run([markdown, data, cancelled, cache, flavour]()
+	{
+		Model model = cache ? cache->find(flavour, data) : Model();
+		if (!model)
+		{
+			model = markdown->parse(data, cancelled.data());
+			if (cache && model)
+			{
+				cache->insert(flavour, model);
+			}
+		}
+		return model;
+	}));
+}
+void QMarkdownViewer::setMarkdownLazily(const QString &flavour, const QByteArray &data)
+{
+	if (m_cancelParse)
+	{
+		m_cancelParse->store(1);
+		m_cancelParse.reset();
+	}
+	// edits would be lost as soon as blocks are filled in, and getMarkdown wouldn't return them either
+	if (!m_lazyFlavour)
+	{
+		m_readOnlyBeforeLazy = isReadOnly();
+		setReadOnly(true);
+	}
+	m_lazyFlavour = QAbstractMarkdown::flavour(flavour);
+	m_model = parse(flavour, data);
+
+	// only the size of the markdown is known without building the blocks, so assume that it is mostly running text
+	const int lineHeight = fontMetrics().lineSpacing();
+	const int charsPerLine = qMax(20, viewport()->width() / qMax(1, fontMetrics().averageCharWidth()));
+	const QVector<int> sizes = m_lazyFlavour->blockSizes(m_model);
+	m_heights.resize(sizes.size() + 1);
+	m_heights[0] = 0;
+	for (int i = 0; i < sizes.size(); ++i)
+	{
+		m_heights[i + 1] = m_heights[i] + (2 + sizes.at(i) / charsPerLine) * lineHeight;
+	}
+
+	m_flavour = flavour;
+	m_markdown = data;
+	m_file.reset();
+	m_windowFirst = 0;
+	m_windowCount = 0;
+	verticalScrollBar()->setValue(0);
+	materialize(true);
+}
+bool QMarkdownViewer::setMarkdownFile(const QString &flavour, const QString &path, const bool lazily)
+{
+	const QSharedPointer<QFile> file(new QFile(path));
+	if (!file->open(QFile::ReadOnly) || file->size() > std::numeric_limits<int>::max())
+	{
+		return false;
+	}
+	QByteArray data;
+	if (file->size() > 0)
+	{
+		uchar *mapped = file->map(0, file->size());
+		if (!mapped)
+		{
+			return false;
+		}
+#ifdef Q_OS_UNIX
+		// the parser reads the file from start to end
+		posix_madvise(mapped, file->size(), POSIX_MADV_SEQUENTIAL);
+#endif
+		data = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), file->size());
+	}
+	m_loadingFile = true;
+	if (lazily)
+	{
+		setMarkdownLazily(flavour, data);
+	}
+	else
+	{
+		setMarkdown(flavour, data);
+	}
+	m_loadingFile = false;
+	// keeps the mapping alive for as long as m_markdown and the model point into it
+	m_file = file;
+	return true;
 }
 QByteArray QMarkdownViewer::getMarkdown(const QString &flavour)
 {
+	if (m_model && flavour == m_flavour)
+	{
+		// a deep copy, as m_markdown might point into a mapped file that goes away
+		return QByteArray(m_markdown.constData(), m_markdown.size());
+	}
 	return QAbstractMarkdown::flavour(flavour)->write(document());
 }
+bool QMarkdownViewer::writeMarkdown(const QString &flavour, QIODevice *device)
+{
+	if (m_model && flavour == m_flavour)
+	{
+		return device->write(m_markdown) == m_markdown.size();
+	}
+	return QAbstractMarkdown::flavour(flavour)->write(document(), device);
+}
+
+void QMarkdownViewer::setCache(QMarkdownCache *cache)
+{
+	m_cache = cache;
+}
+QMarkdownCache *QMarkdownViewer::cache() const
+{
+	return m_cache;
+}
+
+QSharedPointer<const QMarkdownModel> QMarkdownViewer::parse(const QString &flavour, const QByteArray &data)
+{
+	if (m_cache && !m_loadingFile)
+	{
+		return m_cache->parse(flavour, data);
+	}
+	return QAbstractMarkdown::flavour(flavour)->parse(data);
+}
+
+void QMarkdownViewer::materialize(const bool force)
+{
+	if (!m_model || m_materializing)
+	{
+		return;
+	}
+	const int value = verticalScrollBar()->value();
+	const int blockCount = m_heights.size() - 1;
+	const int windowEnd = m_windowFirst + m_windowCount;
+	if (!force)
+	{
+		// the filled in blocks start below the top spacer and end above the bottom spacer
+		const int top = m_heights.at(m_windowFirst);
+		const int bottom = document()->size().height() - (m_heights.last() - m_heights.at(windowEnd));
+		const bool aboveWindow = m_windowFirst > 0 && value < top;
+		const bool belowWindow = windowEnd < blockCount && value + viewport()->height() > bottom;
+		if (!aboveWindow && !belowWindow)
+		{
+			return;
+		}
+	}
+
+	// center the window on the block that is estimated to be at the top of the viewport
+	const int visible = std::upper_bound(m_heights.constBegin(), m_heights.constEnd(), value) - m_heights.constBegin() - 1;
+	m_windowFirst = qBound(0, visible - lazyWindowSize / 2, qMax(0, blockCount - lazyWindowSize));
+	m_windowCount = qMin(lazyWindowSize, blockCount - m_windowFirst);
+
+	m_materializing = true;
+	// applying the blocks restores the state it found, but the spacers are inserted afterwards
+	const bool undoRedoEnabled = document()->isUndoRedoEnabled();
+	m_lazyFlavour->applyBlocks(m_model, document(), m_windowFirst, m_windowCount);
+	document()->setUndoRedoEnabled(false);
+	QTextCursor cursor(document());
+	if (m_windowFirst > 0)
+	{
+		cursor.movePosition(QTextCursor::Start);
+		cursor.insertBlock();
+		cursor.movePosition(QTextCursor::Start);
+		makeSpacer(cursor, m_heights.at(m_windowFirst));
+	}
+	if (m_windowFirst + m_windowCount < blockCount)
+	{
+		cursor.movePosition(QTextCursor::End);
+		cursor.insertBlock();
+		makeSpacer(cursor, m_heights.last() - m_heights.at(m_windowFirst + m_windowCount));
+	}
+	document()->setUndoRedoEnabled(undoRedoEnabled);
+	verticalScrollBar()->setValue(value);
+	m_materializing = false;
+	m_revision = -1;
+}
+void QMarkdownViewer::resetLazy()
+{
+	if (m_lazyFlavour)
+	{
+		m_lazyFlavour.reset();
+		setReadOnly(m_readOnlyBeforeLazy);
+	}
+	m_model.reset();
+}
+void QMarkdownViewer::makeSpacer(QTextCursor &cursor, const int height)
+{
+	if (QTextList *list = cursor.currentList())
+	{
+		list->remove(cursor.block());
+	}
+	QTextBlockFormat format;
+	format.setLineHeight(height, QTextBlockFormat::FixedHeight);
+	cursor.setBlockFormat(format);
+	cursor.setBlockCharFormat(QTextCharFormat());
+}
@@ -1,6 +1,14 @@
 #pragma once
 
 #include <QTextEdit>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <QVector>
+
+class QAbstractMarkdown;
+class QMarkdownModel;
+class QFile;
+class QMarkdownCache;
 
 class QMarkdownViewer : public QTextEdit
 {
@@ -9,5 +17,57 @@ public:
 	QMarkdownViewer(QWidget *parent = 0);
 
 	void setMarkdown(const QString &flavour, const QByteArray &data);
+	/// Like setMarkdown, but parses in a background thread and emits markdownLoaded() once the document has
+	/// been updated. A parse that hasn't finished yet when this is called again is cancelled.
+	void setMarkdownInBackground(const QString &flavour, const QByteArray &data);
+	/// Like setMarkdown, but only the blocks around the visible part are put into the document, the rest is
+	/// replaced by empty space of about the same height and filled in while scrolling. Meant for large, read only
+	/// documents; getMarkdown and writeMarkdown return the markdown that was set. As filling in blocks replaces the
+	/// document the viewer is made read only, until other markdown is set.
+	void setMarkdownLazily(const QString &flavour, const QByteArray &data);
+	/// Like setMarkdown, or setMarkdownLazily if lazily is true, but parses the file at path straight from memory
+	/// mapped pages instead of a copy in memory. Returns false if the file can't be opened or mapped.
+	bool setMarkdownFile(const QString &flavour, const QString &path, const bool lazily = false);
 	QByteArray getMarkdown(const QString &flavour);
+	/// Like getMarkdown, but writes to device as the markdown is produced, returns false if writing failed
+	bool writeMarkdown(const QString &flavour, QIODevice *device);
+
+	/// The cache that parsed markdown is kept in, so that setting the same markdown again only needs to build the
+	/// document. QMarkdownCache::global() by default, null to not cache anything.
+	void setCache(QMarkdownCache *cache);
+	QMarkdownCache *cache() const;
+
+signals:
+	void markdownLoaded();
+
+private:
+	/// The model for data, from the cache if possible
+	QSharedPointer<const QMarkdownModel> parse(const QString &flavour, const QByteArray &data);
+	/// Rebuilds the document around the visible part if it has been scrolled out of the filled in blocks
+	void materialize(const bool force = false);
+	/// Drops what was set by setMarkdownLazily and makes the viewer as editable as it was before
+	void resetLazy();
+	/// Turns the block at cursor into empty space of the given height
+	static void makeSpacer(QTextCursor &cursor, const int height);
+
+	QSharedPointer<QAtomicInt> m_cancelParse;
+	QMarkdownCache *m_cache;
+	// models of mapped files would point into the mapping after it is gone, so they are not cached
+	bool m_loadingFile = false;
+
+	// set by setMarkdownLazily, m_heights are the estimated positions of the blocks with one extra for the end
+	QSharedPointer<QAbstractMarkdown> m_lazyFlavour;
+	QSharedPointer<const QMarkdownModel> m_model;
+	QVector<int> m_heights;
+	int m_windowFirst = 0;
+	int m_windowCount = 0;
+	bool m_materializing = false;
+	bool m_readOnlyBeforeLazy = false;
+
+	// what was read by the last call to setMarkdown, used to only update what has changed
+	QString m_flavour;
+	QByteArray m_markdown;
+	int m_revision = -1;
+	// the file m_markdown points into if it was set by setMarkdownFile
+	QSharedPointer<QFile> m_file;
 };